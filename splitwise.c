@@ -1,15 +1,63 @@
+#ifdef __linux__
+#define _GNU_SOURCE // syncfs
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
+#include <stdarg.h>
+#include <limits.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <pthread.h>
+#endif
 
-#define MAX_USERS 100
+#define MAX_USERS 4096
 #define MAX_GROUPS 50
 #define MAX_EXPENSES 500
 #define MAX_SPLITS 2000
 #define MAX_SETTLEMENTS 500
-#define MAX_LINE 512
-#define DATA_FILE "splitwise_data.txt"
+#define MAX_RECURRING 200
+#define MAX_OPENINGS 500
+#define MAX_ROSTERS 1000
+#define MAX_LINE 65536 // long enough for the GROUP line of a large group
+#define MAX_PAIRS 65536
+#define PAIR_TABLE_SIZE 131072 // power of two, at least 2 * MAX_PAIRS
+#define MAX_PAIR_HEADS 65536
+#define PAIR_HEAD_TABLE_SIZE 131072 // power of two, at least 2 * MAX_PAIR_HEADS
+#define TIMELINE_MIN_CAP 16
+#define TOKEN_TABLE_MIN_SIZE 1024 // power of two; the table doubles as words are added
+#define MAX_TOKEN_LEN 32
+#define MAX_QUERY_TOKENS 8
+#define TOP_K 10
+#define SHARES_PAGE_SIZE 20
+#define LIST_PAGE_SIZE 20
+#define MAX_SPEND_TOTALS 16384
+#define SPEND_TABLE_SIZE 32768 // power of two, at least 2 * MAX_SPEND_TOTALS
+#define EXPENSE_TABLE_SIZE 1024 // power of two, at least 2 * MAX_EXPENSES
+#define USER_NAME_TABLE_SIZE 8192 // power of two, at least 2 * MAX_USERS
+#define GROUP_NAME_TABLE_SIZE 128 // power of two, at least 2 * MAX_GROUPS
+#define SHARD_MEMORY_BUDGET (128 * 1024) // bytes of expense/split/settlement rows kept loaded
+#define DATA_FILE "splitwise_data.txt" // single-file ledger, read once to migrate
+#define DIR_FILE "splitwise_dir.txt" // users, groups and the shard index
+#define SHARD_FILE_FMT "splitwise_group_%d.bin" // one per group: expenses, splits, settlements
+#define SHARD_GEN_FILE_FMT "splitwise_group_%d.%d.bin" // a later generation of the same
+#define TEXT_SHARD_FILE_FMT "splitwise_group_%d.txt" // shards written before the binary encoding
+#define ARCHIVE_FILE_FMT "splitwise_archive_%d.txt" // rows moved out of a group's shard by archiving
+#define FEED_LOG "splitwise_feed.log" // every published change record, in sequence order
+#define FEED_FIFO "splitwise_feed.fifo" // live change records for a --follow consumer
+#define INGEST_QUEUE_CAP 4096
+#define MAX_OP_TYPES 16
+#define LEDGER_MAGIC "SWL1"
+#define LEDGER_BLOCK_SIZE 65536
+#define LZ_HASH_BITS 14
+#define MAX_DICT 255
 
 typedef struct {
     int id;
@@ -19,8 +67,8 @@ typedef struct {
 typedef struct {
     int id;
     char name[64];
-    int member_ids[MAX_USERS];
-    int member_count;
+    int *member_ids; // sorted ascending
+    int member_count, member_cap;
 } Group;
 
 typedef struct {
@@ -32,6 +80,7 @@ typedef struct {
     char date[16]; // DD-MM-YYYY
     char split_type[16]; // "equal", "custom"
     char category[32];
+    int roster_id; // roster an "equal" split is expanded over; 0 if its splits are stored rows
 } Expense;
 
 typedef struct {
@@ -49,11 +98,188 @@ typedef struct {
     char date[16]; // DD-MM-YYYY
 } Settlement;
 
+// A repeating expense stored once; occurrences are derived from the dates on demand.
+typedef struct {
+    int id;
+    int group_id;
+    int paid_by_user_id;
+    double amount; // per occurrence, split equally over member_ids
+    char description[128];
+    char category[32];
+    char frequency[16]; // "weekly", "monthly"
+    char start_date[16]; // DD-MM-YYYY
+    char end_date[16]; // DD-MM-YYYY, "" if open-ended
+    int *member_ids; // group membership when the template was created, sorted
+    int member_count;
+} Recurring;
+
+// A group's members when some equal-split expenses were added. Those expenses store no split rows;
+// their shares are expanded from the roster when needed.
+typedef struct {
+    int id;
+    int group_id;
+    int *member_ids; // sorted
+    int member_count;
+} Roster;
+
+// What one member owed another when the group's older history was archived.
+typedef struct {
+    int group_id;
+    int debtor_id; // 0 for a one-sided adjustment (split rounding left in the payer's balance)
+    int creditor_id;
+    double amount; // positive unless debtor_id is 0
+    char date[16]; // DD-MM-YYYY, the day before the archive cutoff
+} Opening;
+
+// Net debt between two users of a group, stored once per unordered pair.
+typedef struct {
+    int group_id;
+    int lo_id, hi_id; // lo_id < hi_id
+    double amount; // what lo_id owes hi_id; negative when hi_id owes lo_id
+    int next_lo, next_hi; // next pair in lo_id's / hi_id's counterparty list
+} PairDebt;
+
+// A user's entry points within one group.
+typedef struct {
+    int group_id;
+    int user_id;
+    int first; // first pair this user is part of, -1 if none
+    int *shares; // split indices of the user's shares, ordered by expense date
+    int share_count, share_cap;
+} PairHead;
+
+// Per-group running balances over the group's distinct event dates, for "as of" queries.
+typedef struct {
+    int *days; // distinct event dates (date_to_days), ascending
+    int count, cap;
+    double *trees[MAX_USERS]; // per user index: Fenwick tree over days, 1-based
+} Timeline;
+
+typedef struct {
+    int day, expense; // date_to_days of the expense's date; expense index
+} Posting;
+
+// Inverted index entry: a lowercased word from the descriptions and categories of one group's expenses.
+typedef struct {
+    int group_id;
+    char text[MAX_TOKEN_LEN];
+    Posting *postings; // expenses containing the word, ordered by day, then index
+    int count, cap;
+} Token;
+
+// Prefix trie over lower-cased names. Children are found through a hash table keyed by (parent, char).
+typedef struct {
+    int parent; // -1 for the root
+    unsigned char c;
+    int count; // names at or below this node
+    int some; // users[] or groups[] index of one of those names
+} TrieNode;
+
+typedef struct {
+    TrieNode *nodes;
+    int num_nodes, node_cap;
+    int *child_table; // node index + 1, 0 = empty slot
+    int table_size; // power of two, at least 2 * num_nodes
+} NameTrie;
+
+// Bounded min-heap holding the TOP_K largest expenses seen so far.
+typedef struct {
+    int items[TOP_K]; // expense indices, smallest amount at items[0]
+    int count;
+} ExpenseHeap;
+
+// Amount paid by a user, per month (0 = all time) and group (0 = all groups).
+typedef struct {
+    int month; // YYYYMM
+    int group_id;
+    int user_id;
+    double total;
+} SpendTotal;
+
+// Load state of a group's shard file.
+typedef struct {
+    int loaded, dirty;
+    unsigned long last_used; // shard_clock at the last access, for LRU eviction
+    int rows[5]; // expenses, splits, settlements, recurring, openings in the shard
+    int gen; // generation of the shard file the directory file names
+    int pending; // rows were written to generation gen + 1, which the next save switches to
+} Shard;
+
+typedef struct {
+    int group_id, gen;
+} ShardFile;
+
+// Binary ledger stream: records are buffered into blocks that are LZ-compressed on disk.
+typedef struct {
+    FILE *f;
+    unsigned char raw[LEDGER_BLOCK_SIZE];
+    int len, pos; // bytes in raw; read position when decoding
+    char dict[MAX_DICT][32]; // categories and other short repeated strings, in first-seen order
+    int dict_size;
+    int prev[8]; // previous value of each delta-coded field
+    int cut; // ran out of readable blocks before REC_END: the file is truncated or damaged
+} LedgerStream;
+
+typedef struct {
+    int payer_id, receiver_id;
+    double amount;
+} Suggestion;
+
+// A group's computed balances (in member order) and suggested settlements, reused until the group changes.
+typedef struct {
+    unsigned long version; // group_versions[] value the entry was computed at
+    int day; // recurring occurrences were counted up to this day
+    double *balance;
+    Suggestion *suggestions;
+    int suggestion_count;
+} BalanceCache;
+
+// Expense indices in one listing order, by (sort key, id).
+typedef struct {
+    int *items;
+    int count, cap;
+} ExpenseOrder;
+
+enum { SORT_DATE, SORT_AMOUNT, SORT_PAYER, SORT_KEYS };
+enum { REC_END, REC_EXPENSE, REC_SPLIT, REC_SETTLEMENT, REC_RECURRING, REC_OPENING, REC_EQUAL_EXPENSE };
+enum { D_EXPENSE_ID, D_USER, D_DATE, D_SPLIT_EXPENSE, D_SPLIT_USER, D_SETTLEMENT_ID, D_GROUP };
+
 User users[MAX_USERS]; int num_users = 0;
 Group groups[MAX_GROUPS]; int num_groups = 0;
 Expense expenses[MAX_EXPENSES]; int num_expenses = 0;
 Split splits[MAX_SPLITS]; int num_splits = 0;
 Settlement settlements[MAX_SETTLEMENTS]; int num_settlements = 0;
+Recurring recurring[MAX_RECURRING]; int num_recurring = 0;
+Opening openings[MAX_OPENINGS]; int num_openings = 0;
+Roster rosters[MAX_ROSTERS]; int num_rosters = 0;
+int latest_roster[MAX_GROUPS]; // indexed like groups[]: rosters index + 1 of the group's newest roster, 0 = none
+int next_expense_id = 1, next_settlement_id = 1, next_recurring_id = 1;
+Shard shards[MAX_GROUPS]; // indexed like groups[]
+unsigned long group_versions[MAX_GROUPS]; // bumped by every change to a group's rows or members
+BalanceCache balance_cache[MAX_GROUPS]; // indexed like groups[]
+unsigned long shard_clock = 0;
+int expense_table[EXPENSE_TABLE_SIZE]; // loaded expenses by id: index + 1, 0 = empty slot
+long next_feed_seq = 1;
+int feed_fd = -1; // write end of FEED_FIFO while a consumer is attached
+FILE *feed_log; // FEED_LOG, opened on the first record and kept open
+int feed_log_torn = 0; // FEED_LOG ends in a record cut short by a crash
+char *feed_queue; size_t feed_queue_len = 0, feed_queue_cap = 0; // records published since the last save
+long feed_queue_seq = 0; // sequence number of the first queued record
+PairDebt pairs[MAX_PAIRS]; int num_pairs = 0;
+PairHead pair_heads[MAX_PAIR_HEADS]; int num_pair_heads = 0;
+int pair_table[PAIR_TABLE_SIZE]; // pair index + 1, 0 = empty slot
+int pair_head_table[PAIR_HEAD_TABLE_SIZE]; // pair_heads index + 1, 0 = empty slot
+Timeline timelines[MAX_GROUPS]; // indexed like groups[]
+Token *tokens; int num_tokens = 0, token_cap = 0;
+ExpenseOrder expense_orders[MAX_GROUPS + 1][SORT_KEYS]; // indexed like groups[]; the last row holds every group
+ExpenseHeap group_top[MAX_GROUPS]; // indexed like groups[]
+ExpenseHeap overall_top;
+SpendTotal spend_totals[MAX_SPEND_TOTALS]; int num_spend_totals = 0;
+int spend_table[SPEND_TABLE_SIZE]; // spend_totals index + 1, 0 = empty slot
+int *token_table, token_table_size = 0; // tokens index + 1, 0 = empty slot; size is at least 2 * num_tokens
+int user_name_table[USER_NAME_TABLE_SIZE]; // users index + 1 by exact name, 0 = empty slot
+int group_name_table[GROUP_NAME_TABLE_SIZE]; // groups index + 1 by exact name, 0 = empty slot
+NameTrie user_trie, group_trie;
 
 char *trim(char *str) {
     char *end;
@@ -78,121 +304,87 @@ int is_valid_date(const char *date) {
     return 1;
 }
 
-int parse_member_ids(char *s, int *ids) {
-    int count = 0;
-    char *tok = strtok(s, ",");
-    while (tok && count < MAX_USERS) {
-        ids[count++] = atoi(trim(tok));
-        tok = strtok(NULL, ",");
-    }
-    return count;
+// Days since a fixed epoch for a DD-MM-YYYY date, so dates compare as integers.
+int date_to_days(const char *date) {
+    int d = atoi(date), m = atoi(date + 3), y = atoi(date + 6);
+    if (m <= 2) { y--; m += 12; }
+    return 365 * y + y / 4 - y / 100 + y / 400 + (153 * (m - 3) + 2) / 5 + d;
 }
 
-void save_data(const char *filename) {
-    FILE *f = fopen(filename, "w");
-    int i, j;
-    for (i = 0; i < num_users; i++)
-        fprintf(f, "USER|%d|%s\n", users[i].id, users[i].name);
+void days_to_date(int days, char *out) {
+    int z = days - 1;
+    int era = z / 146097, doe = z - era * 146097;
+    int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int mp = (5 * doy + 2) / 153;
+    int d = doy - (153 * mp + 2) / 5 + 1, m = mp < 10 ? mp + 3 : mp - 9, y = yoe + era * 400 + (m <= 2);
+    sprintf(out, "%02d-%02d-%04d", d, m, y);
+}
+
+void today_date(char *out) {
+    time_t now = time(NULL);
+    strftime(out, 16, "%d-%m-%Y", localtime(&now));
+}
+
+int days_in_month(int m, int y) {
+    static const int len[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    if (m == 2 && (y % 4 == 0 && (y % 100 != 0 || y % 400 == 0))) return 29;
+    return len[m - 1];
+}
 
-    for (i = 0; i < num_groups; i++) {
-        fprintf(f, "GROUP|%d|%s|", groups[i].id, groups[i].name);
-        for (j = 0; j < groups[i].member_count; j++)
-            fprintf(f, "%d%s", groups[i].member_ids[j], (j+1==groups[i].member_count?"\n":","));
+int group_member_pos(const Group *g, int uid) {
+    int lo = 0, hi = g->member_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (g->member_ids[mid] < uid) lo = mid + 1; else hi = mid;
     }
+    return lo;
+}
 
-    for (i = 0; i < num_expenses; i++)
-        fprintf(f, "EXPENSE|%d|%d|%d|%.2lf|%s|%s|%s|%s\n", expenses[i].id, expenses[i].group_id, expenses[i].paid_by_user_id,
-                expenses[i].amount, expenses[i].description, expenses[i].date, expenses[i].split_type, expenses[i].category);
+int group_has_member(const Group *g, int uid) {
+    int pos = group_member_pos(g, uid);
+    return pos < g->member_count && g->member_ids[pos] == uid;
+}
 
-    for (i = 0; i < num_splits; i++)
-        fprintf(f, "SPLIT|%d|%d|%.2lf\n", splits[i].expense_id, splits[i].user_id, splits[i].amount);
+// Returns 0 if uid was already a member.
+int group_add_member(Group *g, int uid) {
+    int pos = group_member_pos(g, uid);
+    if (pos < g->member_count && g->member_ids[pos] == uid) return 0;
+    if (g->member_count == g->member_cap) {
+        g->member_cap = g->member_cap ? g->member_cap * 2 : 4;
+        g->member_ids = realloc(g->member_ids, g->member_cap * sizeof(int));
+    }
+    memmove(&g->member_ids[pos + 1], &g->member_ids[pos], (g->member_count - pos) * sizeof(int));
+    g->member_ids[pos] = uid;
+    g->member_count++;
+    return 1;
+}
 
-    for (i = 0; i < num_settlements; i++)
-        fprintf(f, "SETTLEMENT|%d|%d|%d|%.2lf|%d|%s\n", settlements[i].id, settlements[i].payer_id, settlements[i].receiver_id,
-                settlements[i].amount, settlements[i].group_id, settlements[i].date);
-    fclose(f);
+// Returns 0 if uid was not a member.
+int group_remove_member(Group *g, int uid) {
+    int pos = group_member_pos(g, uid);
+    if (pos == g->member_count || g->member_ids[pos] != uid) return 0;
+    memmove(&g->member_ids[pos], &g->member_ids[pos + 1], (g->member_count - pos - 1) * sizeof(int));
+    g->member_count--;
+    return 1;
 }
 
-void load_data(const char *filename) {
-    FILE *f = fopen(filename, "r");
-    if (!f) return;
-    char line[MAX_LINE];
-    while (fgets(line, sizeof(line), f)) {
-        char *type = strtok(line, "|");
-        if (!type) continue;
-        if (strcmp(type, "USER") == 0 && num_users < MAX_USERS) {
-            int id; char name[64];
-            char *idstr = strtok(NULL, "|"), *namestr = strtok(NULL, "\n");
-            if (idstr && namestr) {
-                id = atoi(trim(idstr));
-                strncpy(name, trim(namestr), 63);
-                users[num_users++] = (User){id, ""};
-                strncpy(users[num_users-1].name, name, 63);
-            }
-        } else if (strcmp(type, "GROUP") == 0 && num_groups < MAX_GROUPS) {
-            int id; char name[64], members[256];
-            char *idstr = strtok(NULL, "|");
-            char *namestr = strtok(NULL, "|");
-            char *membersstr = strtok(NULL, "\n");
-            if (idstr && namestr && membersstr) {
-                id = atoi(trim(idstr));
-                strncpy(name, trim(namestr), 63);
-                strncpy(members, trim(membersstr), 255); members[255]=0;
-                groups[num_groups].id = id;
-                strncpy(groups[num_groups].name, name, 63);
-                groups[num_groups].member_count = parse_member_ids(members, groups[num_groups].member_ids);
-                num_groups++;
-            }
-        } else if (strcmp(type, "EXPENSE") == 0 && num_expenses < MAX_EXPENSES) {
-            int id, gid, paid_by;
-            double amt;
-            char desc[128], date[16], stype[16], cat[32];
-            char *idstr = strtok(NULL, "|"), *gidstr = strtok(NULL, "|"), *paidbystr = strtok(NULL, "|"),
-                 *amtstr = strtok(NULL, "|"), *descstr = strtok(NULL, "|"), *datestr = strtok(NULL, "|"),
-                 *stypestr = strtok(NULL, "|"), *catstr = strtok(NULL, "\n");
-            if (idstr && gidstr && paidbystr && amtstr && descstr && datestr && stypestr && catstr) {
-                id = atoi(trim(idstr));
-                gid = atoi(trim(gidstr));
-                paid_by = atoi(trim(paidbystr));
-                amt = atof(trim(amtstr));
-                strncpy(desc, trim(descstr), 127);
-                strncpy(date, trim(datestr), 15);
-                strncpy(stype, trim(stypestr), 15);
-                strncpy(cat, trim(catstr), 31);
-                expenses[num_expenses++] = (Expense){id, gid, paid_by, amt, "", "", "", ""};
-                strncpy(expenses[num_expenses-1].description, desc, 127);
-                strncpy(expenses[num_expenses-1].date, date, 15);
-                strncpy(expenses[num_expenses-1].split_type, stype, 15);
-                strncpy(expenses[num_expenses-1].category, cat, 31);
-            }
-        } else if (strcmp(type, "SPLIT") == 0 && num_splits < MAX_SPLITS) {
-            int eid, uid; double amt;
-            char *eidstr = strtok(NULL, "|"), *uidstr = strtok(NULL, "|"), *amtstr = strtok(NULL, "\n");
-            if (eidstr && uidstr && amtstr) {
-                eid = atoi(trim(eidstr));
-                uid = atoi(trim(uidstr));
-                amt = atof(trim(amtstr));
-                splits[num_splits++] = (Split){eid, uid, amt};
-            }
-        } else if (strcmp(type, "SETTLEMENT") == 0 && num_settlements < MAX_SETTLEMENTS) {
-            int id, payer, recv, gid;
-            double amt;
-            char date[16];
-            char *idstr = strtok(NULL, "|"), *payerstr = strtok(NULL, "|"), *recvstr = strtok(NULL, "|"),
-                 *amtstr = strtok(NULL, "|"), *gidstr = strtok(NULL, "|"), *datestr = strtok(NULL, "\n");
-            if (idstr && payerstr && recvstr && amtstr && gidstr && datestr) {
-                id = atoi(trim(idstr));
-                payer = atoi(trim(payerstr));
-                recv = atoi(trim(recvstr));
-                amt = atof(trim(amtstr));
-                gid = atoi(trim(gidstr));
-                strncpy(date, trim(datestr), 15);
-                settlements[num_settlements++] = (Settlement){id, payer, recv, amt, gid, ""};
-                strncpy(settlements[num_settlements-1].date, date, 15);
-            }
-        }
+int parse_member_ids(char *s, Group *g) {
+    int count = 0;
+    char *tok = strtok(s, ",");
+    while (tok) {
+        count += group_add_member(g, atoi(trim(tok)));
+        tok = strtok(NULL, ",");
     }
-    fclose(f);
+    return count;
+}
+
+unsigned hash_ints(int a, int b, int c) {
+    unsigned h = 2166136261u;
+    h = (h ^ (unsigned)a) * 16777619u;
+    h = (h ^ (unsigned)b) * 16777619u;
+    h = (h ^ (unsigned)c) * 16777619u;
+    return h ^ (h >> 15);
 }
 
 const char* user_name(int id) {
@@ -213,337 +405,4046 @@ int find_group_index(int id) {
     return -1;
 }
 
-void print_users() {
-    printf("Users:\n");
-    for (int i = 0; i < num_users; i++)
-        printf("  %d: %s\n", users[i].id, users[i].name);
+int find_expense_index(int id) {
+    unsigned slot = hash_ints(id, 0, 0) & (EXPENSE_TABLE_SIZE - 1);
+    while (expense_table[slot]) {
+        if (expenses[expense_table[slot] - 1].id == id) return expense_table[slot] - 1;
+        slot = (slot + 1) & (EXPENSE_TABLE_SIZE - 1);
+    }
+    return -1;
 }
 
-void add_user_interactive() {
-    if (num_users >= MAX_USERS) {
-        printf("User limit reached!\n");
-        return;
+int find_pair_head(int gid, int uid, int create) {
+    unsigned slot = hash_ints(gid, uid, 0) & (PAIR_HEAD_TABLE_SIZE - 1);
+    while (pair_head_table[slot]) {
+        PairHead *h = &pair_heads[pair_head_table[slot] - 1];
+        if (h->group_id == gid && h->user_id == uid) return pair_head_table[slot] - 1;
+        slot = (slot + 1) & (PAIR_HEAD_TABLE_SIZE - 1);
     }
-    char name[64];
-    printf("Enter user name: ");
-    fgets(name, sizeof(name), stdin);
-    strcpy(name, trim(name));
-    if(strlen(name) == 0) {
-        printf("Name cannot be empty.\n");
-        return;
+    if (!create || num_pair_heads >= MAX_PAIR_HEADS) return -1;
+    pair_heads[num_pair_heads] = (PairHead){gid, uid, -1, NULL, 0, 0};
+    pair_head_table[slot] = ++num_pair_heads;
+    return num_pair_heads - 1;
+}
+
+int find_pair(int gid, int lo, int hi, int create) {
+    unsigned slot = hash_ints(gid, lo, hi) & (PAIR_TABLE_SIZE - 1);
+    while (pair_table[slot]) {
+        PairDebt *p = &pairs[pair_table[slot] - 1];
+        if (p->group_id == gid && p->lo_id == lo && p->hi_id == hi) return pair_table[slot] - 1;
+        slot = (slot + 1) & (PAIR_TABLE_SIZE - 1);
     }
-    for(int i=0; i<num_users; ++i) {
-        if(strcmp(users[i].name, name)==0) {
-            printf("User with this name already exists.\n");
-            return;
+    if (!create || num_pairs >= MAX_PAIRS) return -1;
+    int lo_head = find_pair_head(gid, lo, 1), hi_head = find_pair_head(gid, hi, 1);
+    if (lo_head < 0 || hi_head < 0) return -1;
+    pairs[num_pairs] = (PairDebt){gid, lo, hi, 0, pair_heads[lo_head].first, pair_heads[hi_head].first};
+    pair_heads[lo_head].first = pair_heads[hi_head].first = num_pairs;
+    pair_table[slot] = ++num_pairs;
+    return num_pairs - 1;
+}
+
+// Record that debtor owes creditor amt more within the group. Returns 0 if the pair tables are full.
+int add_pair_debt(int gid, int debtor, int creditor, double amt) {
+    if (debtor == creditor) return 1;
+    int lo = debtor < creditor ? debtor : creditor, hi = debtor < creditor ? creditor : debtor;
+    int p = find_pair(gid, lo, hi, 1);
+    if (p < 0) return 0;
+    pairs[p].amount += debtor == lo ? amt : -amt;
+    return 1;
+}
+
+// How much debtor owes creditor within the group (negative if creditor owes debtor).
+double pair_debt(int gid, int debtor, int creditor) {
+    int lo = debtor < creditor ? debtor : creditor, hi = debtor < creditor ? creditor : debtor;
+    int p = find_pair(gid, lo, hi, 0);
+    if (p < 0) return 0;
+    return debtor == lo ? pairs[p].amount : -pairs[p].amount;
+}
+
+double fenwick_prefix(const double *tree, int n) {
+    double sum = 0;
+    for (; n > 0; n -= n & -n) sum += tree[n];
+    return sum;
+}
+
+void fenwick_add(double *tree, int size, int i, double delta) {
+    for (; i <= size; i += i & -i) tree[i] += delta;
+}
+
+// Number of timeline dates on or before day.
+int timeline_count_upto(const Timeline *tl, int day) {
+    int lo = 0, hi = tl->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (tl->days[mid] <= day) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+// Position of day in the timeline, inserting it (and a zero slot in every tree) if new.
+int timeline_slot(Timeline *tl, int day) {
+    int pos = timeline_count_upto(tl, day);
+    if (pos > 0 && tl->days[pos - 1] == day) return pos - 1;
+    if (tl->count == tl->cap) {
+        tl->cap = tl->cap ? tl->cap * 2 : TIMELINE_MIN_CAP;
+        tl->days = realloc(tl->days, tl->cap * sizeof(int));
+        for (int u = 0; u < num_users; u++)
+            if (tl->trees[u]) tl->trees[u] = realloc(tl->trees[u], (tl->cap + 1) * sizeof(double));
+    }
+    int n = ++tl->count;
+    memmove(&tl->days[pos + 1], &tl->days[pos], (n - 1 - pos) * sizeof(int));
+    tl->days[pos] = day;
+    for (int u = 0; u < num_users; u++) {
+        double *t = tl->trees[u];
+        if (!t) continue;
+        if (pos == n - 1) {
+            // Appending a zero only needs the new node's range sum.
+            t[n] = fenwick_prefix(t, n - 1) - fenwick_prefix(t, n - (n & -n));
+        } else {
+            // Back-dated entry: unpack to point values, shift, and rebuild in O(n).
+            for (int i = n - 1; i >= 1; i--)
+                if (i + (i & -i) <= n - 1) t[i + (i & -i)] -= t[i];
+            memmove(&t[pos + 2], &t[pos + 1], (n - 1 - pos) * sizeof(double));
+            t[pos + 1] = 0;
+            for (int i = 1; i <= n; i++)
+                if (i + (i & -i) <= n) t[i + (i & -i)] += t[i];
         }
     }
-    users[num_users].id = num_users ? users[num_users - 1].id + 1 : 1;
-    strncpy(users[num_users].name, name, 63);
-    num_users++;
-    printf("User added!\n");
+    return pos;
 }
 
-void remove_user_from_group(int gid, int uid) {
-    int gidx = find_group_index(gid);
-    if (gidx < 0) return;
-    int found = 0;
-    for(int i=0; i<groups[gidx].member_count; ++i) {
-        if(groups[gidx].member_ids[i]==uid) found = 1;
-        if(found && i+1 < groups[gidx].member_count)
-            groups[gidx].member_ids[i] = groups[gidx].member_ids[i+1];
+void timeline_add(int gid, int uid, const char *date, double delta) {
+    int gidx = find_group_index(gid), uidx = find_user_index(uid);
+    if (gidx < 0 || uidx < 0 || !is_valid_date(date)) return;
+    Timeline *tl = &timelines[gidx];
+    int pos = timeline_slot(tl, date_to_days(date));
+    if (!tl->trees[uidx]) tl->trees[uidx] = calloc(tl->cap + 1, sizeof(double));
+    fenwick_add(tl->trees[uidx], tl->count, pos + 1, delta);
+}
+
+// Balance of a user in a group counting only entries dated on or before day.
+double timeline_balance(int gidx, int uid, int day) {
+    Timeline *tl = &timelines[gidx];
+    int uidx = find_user_index(uid);
+    if (uidx < 0 || !tl->trees[uidx]) return 0;
+    return fenwick_prefix(tl->trees[uidx], timeline_count_upto(tl, day));
+}
+
+void reset_timelines() {
+    for (int g = 0; g < MAX_GROUPS; g++) {
+        free(timelines[g].days);
+        for (int u = 0; u < MAX_USERS; u++) free(timelines[g].trees[u]);
+        memset(&timelines[g], 0, sizeof(Timeline));
     }
-    if(found) groups[gidx].member_count--;
 }
 
-void add_group_interactive() {
-    if (num_groups >= MAX_GROUPS) {
-        printf("Group limit reached!\n");
-        return;
+unsigned hash_str(const char *s) {
+    unsigned h = 2166136261u;
+    while (*s) h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h ^ (h >> 15);
+}
+
+int trie_child(const NameTrie *t, int parent, unsigned char c) {
+    if (!t->table_size) return -1;
+    unsigned slot = hash_ints(parent, c, 0) & (t->table_size - 1);
+    while (t->child_table[slot]) {
+        const TrieNode *n = &t->nodes[t->child_table[slot] - 1];
+        if (n->parent == parent && n->c == c) return t->child_table[slot] - 1;
+        slot = (slot + 1) & (t->table_size - 1);
     }
-    char name[64], members[256];
-    int ids[MAX_USERS], count;
-    printf("Enter group name: ");
-    fgets(name, sizeof(name), stdin);
-    strcpy(name, trim(name));
-    if(strlen(name)==0) {
-        printf("Group name cannot be empty.\n");
-        return;
+    return -1;
+}
+
+void trie_place(NameTrie *t, int node) {
+    unsigned slot = hash_ints(t->nodes[node].parent, t->nodes[node].c, 0) & (t->table_size - 1);
+    while (t->child_table[slot]) slot = (slot + 1) & (t->table_size - 1);
+    t->child_table[slot] = node + 1;
+}
+
+int trie_add_node(NameTrie *t, int parent, unsigned char c) {
+    if (t->num_nodes == t->node_cap) {
+        t->node_cap = t->node_cap ? t->node_cap * 2 : 64;
+        t->nodes = realloc(t->nodes, t->node_cap * sizeof(TrieNode));
     }
-    for(int i=0; i<num_groups; ++i) {
-        if(strcmp(groups[i].name, name)==0) {
-            printf("Group with this name already exists.\n");
-            return;
-        }
+    if (2 * (t->num_nodes + 1) > t->table_size) {
+        free(t->child_table);
+        t->table_size = t->table_size ? t->table_size * 2 : 128;
+        t->child_table = calloc(t->table_size, sizeof(int));
+        for (int i = 1; i < t->num_nodes; i++) trie_place(t, i);
     }
-    print_users();
-    printf("Enter comma-separated user IDs for this group: ");
-    fgets(members, sizeof(members), stdin);
-    strcpy(members, trim(members));
-    count = parse_member_ids(members, ids);
-    if(count==0) { printf("No members specified.\n"); return; }
-    groups[num_groups].id = num_groups ? groups[num_groups - 1].id + 1 : 1;
-    strncpy(groups[num_groups].name, name, 63);
-    groups[num_groups].member_count = count;
-    for (int i = 0; i < count; i++)
-        groups[num_groups].member_ids[i] = ids[i];
-    num_groups++;
-    printf("Group added!\n");
+    t->nodes[t->num_nodes] = (TrieNode){parent, c, 0, -1};
+    if (parent >= 0) trie_place(t, t->num_nodes);
+    return t->num_nodes++;
 }
 
-void print_groups() {
-    printf("Groups:\n");
-    for (int i = 0; i < num_groups; i++) {
-        printf("  %d: %s (members: ", groups[i].id, groups[i].name);
-        for (int j = 0; j < groups[i].member_count; j++)
-            printf("%s%s", user_name(groups[i].member_ids[j]), (j+1==groups[i].member_count?"":", "));
-        printf(")\n");
+void trie_insert(NameTrie *t, const char *name, int idx) {
+    int node = t->num_nodes ? 0 : trie_add_node(t, -1, 0);
+    for (;; name++) {
+        t->nodes[node].count++;
+        if (t->nodes[node].some < 0) t->nodes[node].some = idx;
+        if (!*name) return;
+        unsigned char c = tolower((unsigned char)*name);
+        int child = trie_child(t, node, c);
+        node = child >= 0 ? child : trie_add_node(t, node, c);
     }
 }
 
-void add_remove_user_group() {
-    print_groups();
-    printf("Enter group ID: ");
-    int gid;
-    scanf("%d", &gid); getchar();
-    int gidx = find_group_index(gid);
-    if(gidx<0) { printf("Group not found.\n"); return; }
-    printf("1. Add user\n2. Remove user\nChoice: ");
-    int ch;
-    scanf("%d", &ch); getchar();
-    if(ch==1) {
-        print_users();
-        printf("Enter user ID to add: ");
-        int uid; scanf("%d", &uid); getchar(); 
-        for(int i=0; i<groups[gidx].member_count; ++i)
-            if(groups[gidx].member_ids[i]==uid) {
-                printf("User already in group.\n"); return;
-            }
-        groups[gidx].member_ids[groups[gidx].member_count++] = uid;
-        printf("User added to group.\n");
-    } else if(ch==2) {
-        printf("Enter user ID to remove: ");
-        int uid; scanf("%d", &uid); getchar();
-        remove_user_from_group(gid, uid);
-        printf("User removed from group.\n");
+// Returns the index of one name starting with prefix (ignoring case), or -1; stores how many do.
+int trie_find(const NameTrie *t, const char *prefix, int *count) {
+    int node = t->num_nodes ? 0 : -1;
+    for (; node >= 0 && *prefix; prefix++) node = trie_child(t, node, tolower((unsigned char)*prefix));
+    *count = node >= 0 ? t->nodes[node].count : 0;
+    return node >= 0 ? t->nodes[node].some : -1;
+}
+
+int find_user_by_name(const char *name) {
+    unsigned slot = hash_str(name) & (USER_NAME_TABLE_SIZE - 1);
+    while (user_name_table[slot]) {
+        if (strcmp(users[user_name_table[slot] - 1].name, name) == 0) return user_name_table[slot] - 1;
+        slot = (slot + 1) & (USER_NAME_TABLE_SIZE - 1);
     }
+    return -1;
 }
 
-void add_expense_interactive() {
-    if (num_expenses >= MAX_EXPENSES) {
-        printf("Expense limit reached!\n");
-        return;
+int find_group_by_name(const char *name) {
+    unsigned slot = hash_str(name) & (GROUP_NAME_TABLE_SIZE - 1);
+    while (group_name_table[slot]) {
+        if (strcmp(groups[group_name_table[slot] - 1].name, name) == 0) return group_name_table[slot] - 1;
+        slot = (slot + 1) & (GROUP_NAME_TABLE_SIZE - 1);
     }
-    int gid, paid_by, gidx = -1;
-    double amt;
-    char desc[128], date[16], stype[16], cat[32];
-    print_groups();
-    printf("Enter group ID: ");
-    scanf("%d", &gid); getchar();
-    gidx = find_group_index(gid);
-    if (gidx == -1) { printf("Group not found.\n"); return; }
-    printf("Who paid? Enter user ID: ");
-    scanf("%d", &paid_by); getchar();
-    int valid = 0;
-    for(int i=0; i<groups[gidx].member_count; ++i)
-        if(groups[gidx].member_ids[i]==paid_by) valid=1;
-    if(!valid) { printf("User not in group.\n"); return; }
-    printf("Enter amount: ");
-    scanf("%lf", &amt); getchar();
-    if (amt <= 0) {
-        printf("Amount must be positive.\n");
-        return;
+    return -1;
+}
+
+void index_user(int uidx) {
+    unsigned slot = hash_str(users[uidx].name) & (USER_NAME_TABLE_SIZE - 1);
+    while (user_name_table[slot]) slot = (slot + 1) & (USER_NAME_TABLE_SIZE - 1);
+    user_name_table[slot] = uidx + 1;
+    trie_insert(&user_trie, users[uidx].name, uidx);
+}
+
+void index_group(int gidx) {
+    unsigned slot = hash_str(groups[gidx].name) & (GROUP_NAME_TABLE_SIZE - 1);
+    while (group_name_table[slot]) slot = (slot + 1) & (GROUP_NAME_TABLE_SIZE - 1);
+    group_name_table[slot] = gidx + 1;
+    trie_insert(&group_trie, groups[gidx].name, gidx);
+}
+
+int is_number(const char *s) {
+    return *s && strspn(s, "0123456789") == strlen(s);
+}
+
+// Accepts an id, an exact name or a prefix matching a single name. Returns the user id, or -1
+// after printing why the text did not pick out one user.
+int resolve_user(const char *s) {
+    if (is_number(s)) return atoi(s);
+    if (!*s) return -1;
+    int count = 1, i = find_user_by_name(s);
+    if (i < 0) i = trie_find(&user_trie, s, &count);
+    if (i >= 0 && count == 1) return users[i].id;
+    if (count) printf("'%s' matches %d users, e.g. %s.\n", s, count, users[i].name);
+    else printf("No user named '%s'.\n", s);
+    return -1;
+}
+
+int resolve_group(const char *s) {
+    if (is_number(s)) return atoi(s);
+    if (!*s) return -1;
+    int count = 1, i = find_group_by_name(s);
+    if (i < 0) i = trie_find(&group_trie, s, &count);
+    if (i >= 0 && count == 1) return groups[i].id;
+    if (count) printf("'%s' matches %d groups, e.g. %s.\n", s, count, groups[i].name);
+    else printf("No group named '%s'.\n", s);
+    return -1;
+}
+
+int read_user_id(const char *prompt) {
+    char line[128];
+    printf("%s", prompt);
+    if (!fgets(line, sizeof(line), stdin)) return -1;
+    return resolve_user(trim(line));
+}
+
+int read_group_id(const char *prompt) {
+    char line[128];
+    printf("%s", prompt);
+    if (!fgets(line, sizeof(line), stdin)) return -1;
+    return resolve_group(trim(line));
+}
+
+// Split text into lowercased alphanumeric words; returns how many were stored.
+int tokenize(const char *text, char out[][MAX_TOKEN_LEN], int max) {
+    int count = 0;
+    while (*text && count < max) {
+        while (*text && !isalnum((unsigned char)*text)) text++;
+        if (!*text) break;
+        int len = 0;
+        for (; isalnum((unsigned char)*text); text++)
+            if (len < MAX_TOKEN_LEN - 1) out[count][len++] = tolower((unsigned char)*text);
+        out[count++][len] = 0;
+    }
+    return count;
+}
+
+unsigned token_hash(int group_id, const char *text) {
+    return hash_str(text) ^ hash_ints(group_id, 0, 0);
+}
+
+void grow_token_table() {
+    token_table_size = token_table_size ? token_table_size * 2 : TOKEN_TABLE_MIN_SIZE;
+    token_table = realloc(token_table, token_table_size * sizeof(int));
+    memset(token_table, 0, token_table_size * sizeof(int));
+    for (int i = 0; i < num_tokens; i++) {
+        unsigned slot = token_hash(tokens[i].group_id, tokens[i].text) & (token_table_size - 1);
+        while (token_table[slot]) slot = (slot + 1) & (token_table_size - 1);
+        token_table[slot] = i + 1;
+    }
+}
+
+int find_token(int group_id, const char *text, int create) {
+    if (create && 2 * (num_tokens + 1) > token_table_size) grow_token_table();
+    if (!token_table_size) return -1;
+    unsigned slot = token_hash(group_id, text) & (token_table_size - 1);
+    while (token_table[slot]) {
+        Token *tok = &tokens[token_table[slot] - 1];
+        if (tok->group_id == group_id && strcmp(tok->text, text) == 0) return token_table[slot] - 1;
+        slot = (slot + 1) & (token_table_size - 1);
+    }
+    if (!create) return -1;
+    if (num_tokens == token_cap) {
+        token_cap = token_cap ? token_cap * 2 : TOKEN_TABLE_MIN_SIZE / 2;
+        tokens = realloc(tokens, token_cap * sizeof(Token));
+    }
+    memset(&tokens[num_tokens], 0, sizeof(Token));
+    tokens[num_tokens].group_id = group_id;
+    strcpy(tokens[num_tokens].text, text);
+    token_table[slot] = ++num_tokens;
+    return num_tokens - 1;
+}
+
+int compare_postings(const Posting *a, const Posting *b) {
+    if (a->day != b->day) return a->day < b->day ? -1 : 1;
+    return a->expense < b->expense ? -1 : a->expense > b->expense;
+}
+
+// Position of the first posting not before p.
+int posting_lower_bound(const Token *tok, const Posting *p) {
+    int lo = 0, hi = tok->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (compare_postings(&tok->postings[mid], p) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+void index_text(int eidx, const char *text) {
+    char words[64][MAX_TOKEN_LEN];
+    int n = tokenize(text, words, 64);
+    Posting p = {date_to_days(expenses[eidx].date), eidx};
+    for (int i = 0; i < n; i++) {
+        int t = find_token(expenses[eidx].group_id, words[i], 1); // may move tokens
+        Token *tok = &tokens[t];
+        // Expenses mostly arrive in date order, so this is usually an append.
+        int at = tok->count;
+        while (at > 0 && compare_postings(&tok->postings[at - 1], &p) > 0) at--;
+        if (at > 0 && tok->postings[at - 1].expense == eidx) continue;
+        if (tok->count == tok->cap) {
+            tok->cap = tok->cap ? tok->cap * 2 : 4;
+            tok->postings = realloc(tok->postings, tok->cap * sizeof(Posting));
+        }
+        memmove(&tok->postings[at + 1], &tok->postings[at], (tok->count - at) * sizeof(Posting));
+        tok->postings[at] = p;
+        tok->count++;
+    }
+}
+
+void reset_tokens() {
+    for (int i = 0; i < num_tokens; i++) free(tokens[i].postings);
+    num_tokens = 0;
+    if (token_table) memset(token_table, 0, token_table_size * sizeof(int));
+}
+
+void heap_sift_down(ExpenseHeap *h, int i) {
+    while (1) {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        if (l < h->count && expenses[h->items[l]].amount < expenses[h->items[m]].amount) m = l;
+        if (r < h->count && expenses[h->items[r]].amount < expenses[h->items[m]].amount) m = r;
+        if (m == i) return;
+        int tmp = h->items[i]; h->items[i] = h->items[m]; h->items[m] = tmp;
+        i = m;
+    }
+}
+
+void heap_offer(ExpenseHeap *h, int eidx) {
+    if (h->count < TOP_K) {
+        int i = h->count++;
+        h->items[i] = eidx;
+        while (i > 0 && expenses[h->items[(i-1)/2]].amount > expenses[h->items[i]].amount) {
+            int tmp = h->items[i]; h->items[i] = h->items[(i-1)/2]; h->items[(i-1)/2] = tmp;
+            i = (i - 1) / 2;
+        }
+    } else if (expenses[eidx].amount > expenses[h->items[0]].amount) {
+        h->items[0] = eidx;
+        heap_sift_down(h, 0);
+    }
+}
+
+int month_key(const char *date) {
+    return atoi(date + 6) * 100 + atoi(date + 3);
+}
+
+SpendTotal *find_spend_total(int month, int gid, int uid, int create) {
+    unsigned slot = hash_ints(month, gid, uid) & (SPEND_TABLE_SIZE - 1);
+    while (spend_table[slot]) {
+        SpendTotal *t = &spend_totals[spend_table[slot] - 1];
+        if (t->month == month && t->group_id == gid && t->user_id == uid) return t;
+        slot = (slot + 1) & (SPEND_TABLE_SIZE - 1);
+    }
+    if (!create || num_spend_totals >= MAX_SPEND_TOTALS) return NULL;
+    spend_totals[num_spend_totals] = (SpendTotal){month, gid, uid, 0};
+    spend_table[slot] = ++num_spend_totals;
+    return &spend_totals[num_spend_totals - 1];
+}
+
+void add_spend(int eidx) {
+    int months[2] = {0, month_key(expenses[eidx].date)}, gids[2] = {0, expenses[eidx].group_id};
+    for (int m = 0; m < 2; m++)
+        for (int g = 0; g < 2; g++) {
+            SpendTotal *t = find_spend_total(months[m], gids[g], expenses[eidx].paid_by_user_id, 1);
+            if (t) t->total += expenses[eidx].amount;
+        }
+}
+
+// Date of the k-th occurrence (k = 0 is the start date).
+void recurring_date(const Recurring *r, int k, char *out) {
+    if (strcmp(r->frequency, "weekly") == 0) {
+        days_to_date(date_to_days(r->start_date) + 7 * k, out);
+        return;
+    }
+    int d = atoi(r->start_date), months = atoi(r->start_date + 6) * 12 + atoi(r->start_date + 3) - 1 + k;
+    int y = months / 12, m = months % 12 + 1;
+    sprintf(out, "%02d-%02d-%04d", d < days_in_month(m, y) ? d : days_in_month(m, y), m, y);
+}
+
+// Number of occurrences dated on or before date, computed without enumerating them.
+int recurring_count(const Recurring *r, const char *date) {
+    const char *upto = date;
+    if (r->end_date[0] && date_to_days(r->end_date) < date_to_days(date)) upto = r->end_date;
+    if (date_to_days(upto) < date_to_days(r->start_date)) return 0;
+    if (strcmp(r->frequency, "weekly") == 0)
+        return (date_to_days(upto) - date_to_days(r->start_date)) / 7 + 1;
+    int d = atoi(upto), m = atoi(upto + 3), y = atoi(upto + 6), sd = atoi(r->start_date);
+    int n = (y * 12 + m) - (atoi(r->start_date + 6) * 12 + atoi(r->start_date + 3));
+    return n + (d >= (sd < days_in_month(m, y) ? sd : days_in_month(m, y)));
+}
+
+int recurring_has_member(const Recurring *r, int uid) {
+    Group snapshot = {0, "", r->member_ids, r->member_count, r->member_count};
+    return group_has_member(&snapshot, uid);
+}
+
+// Net effect of a group's recurring expenses on a member's balance up to date.
+double recurring_balance(int gid, int uid, const char *date) {
+    double bal = 0;
+    for (int i = 0; i < num_recurring; i++) {
+        Recurring *r = &recurring[i];
+        if (r->group_id != gid) continue;
+        int n = recurring_count(r, date);
+        if (r->paid_by_user_id == uid) bal += n * r->amount;
+        if (recurring_has_member(r, uid)) bal -= n * r->amount / r->member_count;
+    }
+    return bal;
+}
+
+// What debtor owes creditor through the group's recurring expenses up to date.
+double recurring_pair_debt(int gid, int debtor, int creditor, const char *date) {
+    double owed = 0;
+    for (int i = 0; i < num_recurring; i++) {
+        Recurring *r = &recurring[i];
+        if (r->group_id != gid) continue;
+        if (r->paid_by_user_id == creditor && recurring_has_member(r, debtor))
+            owed += recurring_count(r, date) * r->amount / r->member_count;
+        else if (r->paid_by_user_id == debtor && recurring_has_member(r, creditor))
+            owed -= recurring_count(r, date) * r->amount / r->member_count;
+    }
+    return owed;
+}
+
+long long to_cents(double amount) {
+    return (long long)(amount * 100 + (amount < 0 ? -0.5 : 0.5));
+}
+
+// Share of the i-th of count members in an equal split: whole cents, the first few taking the leftover
+// cents, so the shares add up to the amount exactly.
+double equal_share(double amount, int count, int i) {
+    long long cents = to_cents(amount);
+    return (cents / count + (i < cents % count)) / 100.0;
+}
+
+const Roster *find_roster(int id) {
+    // Rosters are only ever appended, so the id is normally the position.
+    if (id >= 1 && id <= num_rosters && rosters[id - 1].id == id) return &rosters[id - 1];
+    for (int i = 0; i < num_rosters; i++)
+        if (rosters[i].id == id) return &rosters[i];
+    return NULL;
+}
+
+// The roster an expense's equal split expands over, or NULL if its splits are stored rows.
+const Roster *expense_roster(int eidx) {
+    return expenses[eidx].roster_id ? find_roster(expenses[eidx].roster_id) : NULL;
+}
+
+// Id of a roster holding the group's current members, adding one if they changed; 0 if the table is full.
+int current_roster(int gidx) {
+    const Group *g = &groups[gidx];
+    int r = latest_roster[gidx] - 1;
+    if (r >= 0 && rosters[r].member_count == g->member_count &&
+        memcmp(rosters[r].member_ids, g->member_ids, g->member_count * sizeof(int)) == 0)
+        return rosters[r].id;
+    if (num_rosters >= MAX_ROSTERS) return 0;
+    Roster *nr = &rosters[num_rosters];
+    *nr = (Roster){num_rosters ? rosters[num_rosters - 1].id + 1 : 1, g->id, malloc(g->member_count * sizeof(int)),
+                   g->member_count};
+    memcpy(nr->member_ids, g->member_ids, g->member_count * sizeof(int));
+    latest_roster[gidx] = ++num_rosters;
+    return nr->id;
+}
+
+// Index hooks: every expense, split and settlement that enters the tables goes through these.
+// Payer order breaks ties by date, so the key packs both.
+long long expense_sort_key(int eidx, int sort) {
+    if (sort == SORT_AMOUNT) return to_cents(expenses[eidx].amount);
+    if (sort == SORT_PAYER) return (long long)expenses[eidx].paid_by_user_id << 32 | (unsigned)date_to_days(expenses[eidx].date);
+    return date_to_days(expenses[eidx].date);
+}
+
+// First position in the order at or after (key, id).
+int order_lower_bound(const ExpenseOrder *o, int sort, long long key, int id) {
+    int lo = 0, hi = o->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        long long k = expense_sort_key(o->items[mid], sort);
+        if (k < key || (k == key && expenses[o->items[mid]].id < id)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+void order_insert(ExpenseOrder *o, int sort, int eidx) {
+    if (o->count == o->cap) {
+        o->cap = o->cap ? o->cap * 2 : 16;
+        o->items = realloc(o->items, o->cap * sizeof(int));
+    }
+    int pos = order_lower_bound(o, sort, expense_sort_key(eidx, sort), expenses[eidx].id);
+    memmove(&o->items[pos + 1], &o->items[pos], (o->count - pos) * sizeof(int));
+    o->items[pos] = eidx;
+    o->count++;
+}
+
+// A share list entry is a splits[] index, or -(expense index + 1) for a share of an implicit equal split.
+int share_expense(int ref) {
+    return ref >= 0 ? find_expense_index(splits[ref].expense_id) : -ref - 1;
+}
+
+int share_day(int ref) {
+    return date_to_days(expenses[share_expense(ref)].date);
+}
+
+double share_amount(int ref, int uid) {
+    if (ref >= 0) return splits[ref].amount;
+    const Roster *r = expense_roster(-ref - 1);
+    Group g = {0};
+    g.member_ids = r->member_ids;
+    g.member_count = r->member_count;
+    return equal_share(expenses[-ref - 1].amount, r->member_count, group_member_pos(&g, uid));
+}
+
+// Number of the head's shares dated before day (day + 1 gives those on or before day).
+int shares_before(const PairHead *h, int day) {
+    int lo = 0, hi = h->share_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (share_day(h->shares[mid]) < day) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+void add_share(int eidx, int uid, int ref) {
+    int h = find_pair_head(expenses[eidx].group_id, uid, 1);
+    if (h < 0) return;
+    PairHead *p = &pair_heads[h];
+    if (p->share_count == p->share_cap) {
+        p->share_cap = p->share_cap ? p->share_cap * 2 : 4;
+        p->shares = realloc(p->shares, p->share_cap * sizeof(int));
+    }
+    // Shares mostly arrive in date order, so this is usually an append.
+    int pos = shares_before(p, date_to_days(expenses[eidx].date) + 1);
+    memmove(&p->shares[pos + 1], &p->shares[pos], (p->share_count - pos) * sizeof(int));
+    p->shares[pos] = ref;
+    p->share_count++;
+}
+
+// The index_* functions return 0 when the pair tables are full, leaving the indexes partly updated;
+// callers drop the rows again with drop_rows_from().
+int index_share(int eidx, int uid, double amount, int ref) {
+    if (!add_pair_debt(expenses[eidx].group_id, uid, expenses[eidx].paid_by_user_id, amount)) return 0;
+    timeline_add(expenses[eidx].group_id, uid, expenses[eidx].date, -amount);
+    add_share(eidx, uid, ref);
+    return 1;
+}
+
+int index_split(int eidx, int sidx) {
+    return index_share(eidx, splits[sidx].user_id, splits[sidx].amount, sidx);
+}
+
+int index_expense(int eidx) {
+    unsigned slot = hash_ints(expenses[eidx].id, 0, 0) & (EXPENSE_TABLE_SIZE - 1);
+    while (expense_table[slot] && expenses[expense_table[slot] - 1].id != expenses[eidx].id)
+        slot = (slot + 1) & (EXPENSE_TABLE_SIZE - 1);
+    if (!expense_table[slot]) expense_table[slot] = eidx + 1;
+    index_text(eidx, expenses[eidx].description);
+    index_text(eidx, expenses[eidx].category);
+    int gidx = find_group_index(expenses[eidx].group_id);
+    if (gidx >= 0) heap_offer(&group_top[gidx], eidx);
+    heap_offer(&overall_top, eidx);
+    for (int s = 0; s < SORT_KEYS; s++) {
+        if (gidx >= 0) order_insert(&expense_orders[gidx][s], s, eidx);
+        order_insert(&expense_orders[MAX_GROUPS][s], s, eidx);
+    }
+    add_spend(eidx);
+    timeline_add(expenses[eidx].group_id, expenses[eidx].paid_by_user_id, expenses[eidx].date, expenses[eidx].amount);
+    const Roster *r = expense_roster(eidx);
+    for (int i = 0; r && i < r->member_count; i++)
+        if (!index_share(eidx, r->member_ids[i], equal_share(expenses[eidx].amount, r->member_count, i), -eidx - 1))
+            return 0;
+    return 1;
+}
+
+int index_recurring(int ridx) {
+    // Amounts are derived at query time; only make sure the pairs can be listed.
+    for (int i = 0; i < recurring[ridx].member_count; i++)
+        if (!add_pair_debt(recurring[ridx].group_id, recurring[ridx].member_ids[i], recurring[ridx].paid_by_user_id, 0))
+            return 0;
+    return 1;
+}
+
+int index_settlement(int sidx) {
+    Settlement *s = &settlements[sidx];
+    // The payer's debt to the receiver shrinks, i.e. the receiver owes the payer more.
+    if (!add_pair_debt(s->group_id, s->receiver_id, s->payer_id, s->amount)) return 0;
+    timeline_add(s->group_id, s->payer_id, s->date, s->amount);
+    timeline_add(s->group_id, s->receiver_id, s->date, -s->amount);
+    return 1;
+}
+
+int index_opening(int oidx) {
+    Opening *o = &openings[oidx];
+    if (o->debtor_id) {
+        if (!add_pair_debt(o->group_id, o->debtor_id, o->creditor_id, o->amount)) return 0;
+        timeline_add(o->group_id, o->debtor_id, o->date, -o->amount);
+    }
+    timeline_add(o->group_id, o->creditor_id, o->date, o->amount);
+    return 1;
+}
+
+// Index the rows appended since the given table sizes. Returns 0 if the pair tables filled up.
+int index_rows_from(int e0, int s0, int st0, int r0, int o0) {
+    for (int i = e0; i < num_expenses; i++)
+        if (!index_expense(i)) return 0;
+    for (int i = s0; i < num_splits; i++) {
+        int e = find_expense_index(splits[i].expense_id);
+        if (e >= 0 && !index_split(e, i)) return 0;
+    }
+    for (int i = st0; i < num_settlements; i++)
+        if (!index_settlement(i)) return 0;
+    for (int i = r0; i < num_recurring; i++)
+        if (!index_recurring(i)) return 0;
+    for (int i = o0; i < num_openings; i++)
+        if (!index_opening(i)) return 0;
+    return 1;
+}
+
+int rebuild_indexes() {
+    memset(expense_table, 0, sizeof(expense_table));
+    for (int i = 0; i < num_pair_heads; i++) free(pair_heads[i].shares);
+    num_pairs = num_pair_heads = 0;
+    memset(pair_table, 0, sizeof(pair_table));
+    memset(pair_head_table, 0, sizeof(pair_head_table));
+    reset_timelines();
+    reset_tokens();
+    memset(group_top, 0, sizeof(group_top));
+    memset(&overall_top, 0, sizeof(overall_top));
+    for (int g = 0; g <= MAX_GROUPS; g++)
+        for (int s = 0; s < SORT_KEYS; s++) expense_orders[g][s].count = 0;
+    num_spend_totals = 0;
+    memset(spend_table, 0, sizeof(spend_table));
+    return index_rows_from(0, 0, 0, 0, 0);
+}
+
+// Removes the rows appended since the given table sizes and rebuilds the indexes without them.
+void drop_rows_from(int e0, int s0, int st0, int r0, int o0) {
+    for (int i = r0; i < num_recurring; i++) free(recurring[i].member_ids);
+    num_expenses = e0; num_splits = s0; num_settlements = st0; num_recurring = r0; num_openings = o0;
+    rebuild_indexes();
+}
+
+void write_members(FILE *f, const int *ids, int count) {
+    for (int j = 0; j < count; j++)
+        fprintf(f, "%d%s", ids[j], (j+1==count?"\n":","));
+    if (!count) fprintf(f, "\n");
+}
+
+void write_group_row(FILE *f, const Group *g) {
+    fprintf(f, "GROUP|%d|%s|", g->id, g->name);
+    write_members(f, g->member_ids, g->member_count);
+}
+
+void write_roster_row(FILE *f, const Roster *r) {
+    fprintf(f, "ROSTER|%d|%d|", r->id, r->group_id);
+    write_members(f, r->member_ids, r->member_count);
+}
+
+void write_expense_row(FILE *f, const Expense *e) {
+    fprintf(f, "EXPENSE|%d|%d|%d|%.2lf|%s|%s|%s|%s", e->id, e->group_id, e->paid_by_user_id,
+            e->amount, e->description, e->date, e->split_type, e->category);
+    if (e->roster_id) fprintf(f, "|%d", e->roster_id);
+    fprintf(f, "\n");
+}
+
+void write_split_row(FILE *f, const Split *sp) {
+    fprintf(f, "SPLIT|%d|%d|%.2lf\n", sp->expense_id, sp->user_id, sp->amount);
+}
+
+void write_settlement_row(FILE *f, const Settlement *st) {
+    fprintf(f, "SETTLEMENT|%d|%d|%d|%.2lf|%d|%s\n", st->id, st->payer_id, st->receiver_id,
+            st->amount, st->group_id, st->date);
+}
+
+void write_recurring_row(FILE *f, const Recurring *r) {
+    fprintf(f, "RECURRING|%d|%d|%d|%.2lf|%s|%s|%s|%s|%s|", r->id, r->group_id, r->paid_by_user_id, r->amount,
+            r->description, r->category, r->frequency, r->start_date, r->end_date[0] ? r->end_date : "-");
+    write_members(f, r->member_ids, r->member_count);
+}
+
+void write_opening_row(FILE *f, const Opening *o) {
+    fprintf(f, "OPENING|%d|%d|%d|%.2lf|%s\n", o->group_id, o->debtor_id, o->creditor_id, o->amount, o->date);
+}
+
+void write_users_groups(FILE *f) {
+    int i;
+    for (i = 0; i < num_users; i++)
+        fprintf(f, "USER|%d|%s\n", users[i].id, users[i].name);
+
+    for (i = 0; i < num_groups; i++)
+        write_group_row(f, &groups[i]);
+
+    for (i = 0; i < num_rosters; i++)
+        write_roster_row(f, &rosters[i]);
+}
+
+// Writes the loaded rows of one group (every row when gid is 0); counts them into rows if given.
+// With before_day set, only dated rows from before that day are written, for archiving.
+void write_group_rows(FILE *f, int gid, int before_day, int *rows) {
+    int i, n[5] = {0};
+    for (i = 0; i < num_expenses; i++) {
+        if (gid && expenses[i].group_id != gid) continue;
+        if (before_day && date_to_days(expenses[i].date) >= before_day) continue;
+        write_expense_row(f, &expenses[i]);
+        n[0]++;
+    }
+
+    for (i = 0; i < num_splits; i++) {
+        int e = find_expense_index(splits[i].expense_id);
+        if (gid && (e < 0 || expenses[e].group_id != gid)) continue;
+        if (before_day && (e < 0 || date_to_days(expenses[e].date) >= before_day)) continue;
+        write_split_row(f, &splits[i]);
+        n[1]++;
+    }
+
+    for (i = 0; i < num_settlements; i++) {
+        if (gid && settlements[i].group_id != gid) continue;
+        if (before_day && date_to_days(settlements[i].date) >= before_day) continue;
+        write_settlement_row(f, &settlements[i]);
+        n[2]++;
+    }
+
+    for (i = 0; i < num_recurring; i++) {
+        if ((gid && recurring[i].group_id != gid) || before_day) continue;
+        write_recurring_row(f, &recurring[i]);
+        n[3]++;
+    }
+
+    for (i = 0; i < num_openings; i++) {
+        Opening *o = &openings[i];
+        if (gid && o->group_id != gid) continue;
+        if (before_day && date_to_days(o->date) >= before_day) continue;
+        write_opening_row(f, o);
+        n[4]++;
+    }
+    if (rows) memcpy(rows, n, sizeof(n));
+}
+
+void save_data(const char *filename) {
+    FILE *f = fopen(filename, "w");
+    write_users_groups(f);
+    write_group_rows(f, 0, 0, NULL);
+    fclose(f);
+}
+
+void load_data(const char *filename) {
+    FILE *f = fopen(filename, "r");
+    if (!f) return;
+    char line[MAX_LINE];
+    while (fgets(line, sizeof(line), f)) {
+        char *type = strtok(line, "|");
+        if (!type) continue;
+        if (strcmp(type, "USER") == 0 && num_users < MAX_USERS) {
+            int id; char name[64];
+            char *idstr = strtok(NULL, "|"), *namestr = strtok(NULL, "\n");
+            if (idstr && namestr) {
+                id = atoi(trim(idstr));
+                strncpy(name, trim(namestr), 63);
+                users[num_users++] = (User){id, ""};
+                strncpy(users[num_users-1].name, name, 63);
+                index_user(num_users-1);
+            }
+        } else if (strcmp(type, "GROUP") == 0 && num_groups < MAX_GROUPS) {
+            int id; char name[64];
+            char *idstr = strtok(NULL, "|");
+            char *namestr = strtok(NULL, "|");
+            char *membersstr = strtok(NULL, "\n");
+            if (idstr && namestr && membersstr) {
+                id = atoi(trim(idstr));
+                strncpy(name, trim(namestr), 63);
+                groups[num_groups] = (Group){id, "", NULL, 0, 0};
+                shards[num_groups] = (Shard){0};
+                strncpy(groups[num_groups].name, name, 63);
+                parse_member_ids(trim(membersstr), &groups[num_groups]);
+                index_group(num_groups++);
+            }
+        } else if (strcmp(type, "ROSTER") == 0 && num_rosters < MAX_ROSTERS) {
+            char *idstr = strtok(NULL, "|"), *gidstr = strtok(NULL, "|"), *membersstr = strtok(NULL, "\n");
+            if (idstr && gidstr && membersstr) {
+                Group g = {0};
+                parse_member_ids(trim(membersstr), &g);
+                rosters[num_rosters++] = (Roster){atoi(trim(idstr)), atoi(trim(gidstr)), g.member_ids, g.member_count};
+                int gidx = find_group_index(rosters[num_rosters-1].group_id);
+                if (gidx >= 0) latest_roster[gidx] = num_rosters;
+            }
+        } else if (strcmp(type, "EXPENSE") == 0 && num_expenses < MAX_EXPENSES) {
+            int id, gid, paid_by;
+            double amt;
+            char desc[128], date[16], stype[16], cat[32];
+            char *idstr = strtok(NULL, "|"), *gidstr = strtok(NULL, "|"), *paidbystr = strtok(NULL, "|"),
+                 *amtstr = strtok(NULL, "|"), *descstr = strtok(NULL, "|"), *datestr = strtok(NULL, "|"),
+                 *stypestr = strtok(NULL, "|"), *catstr = strtok(NULL, "\n");
+            if (idstr && gidstr && paidbystr && amtstr && descstr && datestr && stypestr && catstr) {
+                // An implicit equal split ends the row with its roster id.
+                char *rosterstr = strchr(catstr, '|');
+                if (rosterstr) *rosterstr++ = 0;
+                id = atoi(trim(idstr));
+                gid = atoi(trim(gidstr));
+                paid_by = atoi(trim(paidbystr));
+                amt = atof(trim(amtstr));
+                strncpy(desc, trim(descstr), 127);
+                strncpy(date, trim(datestr), 15);
+                strncpy(stype, trim(stypestr), 15);
+                strncpy(cat, trim(catstr), 31);
+                expenses[num_expenses++] = (Expense){id, gid, paid_by, amt, "", "", "", "", 0};
+                strncpy(expenses[num_expenses-1].description, desc, 127);
+                strncpy(expenses[num_expenses-1].date, date, 15);
+                strncpy(expenses[num_expenses-1].split_type, stype, 15);
+                strncpy(expenses[num_expenses-1].category, cat, 31);
+                if (rosterstr) expenses[num_expenses-1].roster_id = atoi(trim(rosterstr));
+                if (id >= next_expense_id) next_expense_id = id + 1;
+            }
+        } else if (strcmp(type, "SPLIT") == 0 && num_splits < MAX_SPLITS) {
+            int eid, uid; double amt;
+            char *eidstr = strtok(NULL, "|"), *uidstr = strtok(NULL, "|"), *amtstr = strtok(NULL, "\n");
+            if (eidstr && uidstr && amtstr) {
+                eid = atoi(trim(eidstr));
+                uid = atoi(trim(uidstr));
+                amt = atof(trim(amtstr));
+                splits[num_splits++] = (Split){eid, uid, amt};
+            }
+        } else if (strcmp(type, "SETTLEMENT") == 0 && num_settlements < MAX_SETTLEMENTS) {
+            int id, payer, recv, gid;
+            double amt;
+            char date[16];
+            char *idstr = strtok(NULL, "|"), *payerstr = strtok(NULL, "|"), *recvstr = strtok(NULL, "|"),
+                 *amtstr = strtok(NULL, "|"), *gidstr = strtok(NULL, "|"), *datestr = strtok(NULL, "\n");
+            if (idstr && payerstr && recvstr && amtstr && gidstr && datestr) {
+                id = atoi(trim(idstr));
+                payer = atoi(trim(payerstr));
+                recv = atoi(trim(recvstr));
+                amt = atof(trim(amtstr));
+                gid = atoi(trim(gidstr));
+                strncpy(date, trim(datestr), 15);
+                settlements[num_settlements++] = (Settlement){id, payer, recv, amt, gid, ""};
+                strncpy(settlements[num_settlements-1].date, date, 15);
+                if (id >= next_settlement_id) next_settlement_id = id + 1;
+            }
+        } else if (strcmp(type, "RECURRING") == 0 && num_recurring < MAX_RECURRING) {
+            char *idstr = strtok(NULL, "|"), *gidstr = strtok(NULL, "|"), *paidbystr = strtok(NULL, "|"),
+                 *amtstr = strtok(NULL, "|"), *descstr = strtok(NULL, "|"), *catstr = strtok(NULL, "|"),
+                 *freqstr = strtok(NULL, "|"), *startstr = strtok(NULL, "|"), *endstr = strtok(NULL, "|"),
+                 *membersstr = strtok(NULL, "\n");
+            if (idstr && gidstr && paidbystr && amtstr && descstr && catstr && freqstr && startstr && endstr && membersstr) {
+                Recurring *r = &recurring[num_recurring];
+                *r = (Recurring){atoi(trim(idstr)), atoi(trim(gidstr)), atoi(trim(paidbystr)), atof(trim(amtstr)),
+                                 "", "", "", "", "", NULL, 0};
+                strncpy(r->description, trim(descstr), 127);
+                strncpy(r->category, trim(catstr), 31);
+                strncpy(r->frequency, trim(freqstr), 15);
+                strncpy(r->start_date, trim(startstr), 15);
+                if (strcmp(trim(endstr), "-") != 0) strncpy(r->end_date, trim(endstr), 15);
+                Group snapshot = {0};
+                parse_member_ids(trim(membersstr), &snapshot);
+                r->member_ids = snapshot.member_ids;
+                r->member_count = snapshot.member_count;
+                if (r->id >= next_recurring_id) next_recurring_id = r->id + 1;
+                if (r->member_count > 0) num_recurring++;
+            }
+        } else if (strcmp(type, "OPENING") == 0 && num_openings < MAX_OPENINGS) {
+            char *gidstr = strtok(NULL, "|"), *debtorstr = strtok(NULL, "|"), *creditorstr = strtok(NULL, "|"),
+                 *amtstr = strtok(NULL, "|"), *datestr = strtok(NULL, "\n");
+            if (gidstr && debtorstr && creditorstr && amtstr && datestr) {
+                openings[num_openings++] = (Opening){atoi(trim(gidstr)), atoi(trim(debtorstr)), atoi(trim(creditorstr)),
+                                                     atof(trim(amtstr)), ""};
+                strncpy(openings[num_openings-1].date, trim(datestr), 15);
+            }
+        } else if (strcmp(type, "SHARD") == 0) {
+            char *gidstr = strtok(NULL, "|"), *counts[5];
+            for (int i = 0; i < 5; i++) counts[i] = strtok(NULL, "|\n");
+            char *genstr = strtok(NULL, "|\n");
+            int gidx = gidstr ? find_group_index(atoi(trim(gidstr))) : -1;
+            if (gidx >= 0 && counts[3]) // directories written before archiving have no opening count
+                for (int i = 0; i < 5; i++) shards[gidx].rows[i] = counts[i] ? atoi(trim(counts[i])) : 0;
+            if (gidx >= 0) shards[gidx].gen = genstr ? atoi(trim(genstr)) : 0;
+        } else if (strcmp(type, "NEXT") == 0) {
+            char *eidstr = strtok(NULL, "|"), *sidstr = strtok(NULL, "|"), *ridstr = strtok(NULL, "\n");
+            if (eidstr && sidstr && ridstr) {
+                if (atoi(eidstr) > next_expense_id) next_expense_id = atoi(eidstr);
+                if (atoi(sidstr) > next_settlement_id) next_settlement_id = atoi(sidstr);
+                if (atoi(ridstr) > next_recurring_id) next_recurring_id = atoi(ridstr);
+            }
+        } else if (strcmp(type, "FEED") == 0) {
+            char *seqstr = strtok(NULL, "\n");
+            if (seqstr && atol(seqstr) > next_feed_seq) next_feed_seq = atol(seqstr);
+        }
+    }
+    fclose(f);
+}
+
+// Calendar dates as consecutive integers (31 slots per month), so any DD-MM-YYYY round-trips.
+int date_key(const char *date) {
+    if (!is_valid_date(date)) return 0;
+    return atoi(date + 6) * 372 + (atoi(date + 3) - 1) * 31 + atoi(date) - 1;
+}
+
+void key_to_date(int key, char *out) {
+    if (key <= 0) { out[0] = 0; return; }
+    sprintf(out, "%02d-%02d-%04d", key % 31 + 1, key % 372 / 31 + 1, key / 372);
+}
+
+void put_varint(unsigned char *out, int *n, unsigned long long v) {
+    while (v >= 0x80) { out[(*n)++] = (unsigned char)(v | 0x80); v >>= 7; }
+    out[(*n)++] = (unsigned char)v;
+}
+
+unsigned long long get_varint(const unsigned char *in, int *pos, int n) {
+    unsigned long long v = 0;
+    for (int shift = 0; *pos < n && shift < 64; shift += 7) {
+        unsigned char c = in[(*pos)++];
+        v |= (unsigned long long)(c & 0x7f) << shift;
+        if (!(c & 0x80)) break;
+    }
+    return v;
+}
+
+// Greedy LZ77: varint literal count, literals, varint match length (0 = none), varint offset.
+int lz_compress(const unsigned char *in, int n, unsigned char *out) {
+    static int table[1 << LZ_HASH_BITS];
+    int ip = 0, anchor = 0, op = 0;
+    for (int i = 0; i < (1 << LZ_HASH_BITS); i++) table[i] = -1;
+    while (ip + 4 <= n) {
+        unsigned word;
+        memcpy(&word, in + ip, 4);
+        unsigned h = (word * 2654435761u) >> (32 - LZ_HASH_BITS);
+        int ref = table[h];
+        table[h] = ip;
+        if (ref < 0 || memcmp(in + ref, in + ip, 4) != 0) { ip++; continue; }
+        int len = 4;
+        while (ip + len < n && in[ref + len] == in[ip + len]) len++;
+        put_varint(out, &op, ip - anchor);
+        memcpy(out + op, in + anchor, ip - anchor); op += ip - anchor;
+        put_varint(out, &op, len);
+        put_varint(out, &op, ip - ref);
+        ip += len;
+        anchor = ip;
+    }
+    put_varint(out, &op, n - anchor);
+    memcpy(out + op, in + anchor, n - anchor); op += n - anchor;
+    put_varint(out, &op, 0);
+    return op;
+}
+
+// Returns the decompressed size, or -1 if the block is malformed.
+int lz_decompress(const unsigned char *in, int n, unsigned char *out, int cap) {
+    int ip = 0, op = 0;
+    while (ip < n) {
+        int lit = (int)get_varint(in, &ip, n);
+        if (lit < 0 || ip + lit > n || op + lit > cap) return -1;
+        memcpy(out + op, in + ip, lit); ip += lit; op += lit;
+        int len = (int)get_varint(in, &ip, n);
+        if (len == 0) continue;
+        int off = (int)get_varint(in, &ip, n);
+        if (off <= 0 || off > op || op + len > cap) return -1;
+        for (int i = 0; i < len; i++, op++) out[op] = out[op - off];
+    }
+    return op;
+}
+
+void stream_flush(LedgerStream *ls) {
+    static unsigned char comp[LEDGER_BLOCK_SIZE * 2];
+    unsigned char head[20];
+    int hn = 0, cn = lz_compress(ls->raw, ls->len, comp);
+    put_varint(head, &hn, ls->len);
+    put_varint(head, &hn, cn < ls->len ? cn : 0); // 0: block stored uncompressed
+    fwrite(head, 1, hn, ls->f);
+    if (cn < ls->len) fwrite(comp, 1, cn, ls->f);
+    else fwrite(ls->raw, 1, ls->len, ls->f);
+    ls->len = 0;
+}
+
+void stream_put(LedgerStream *ls, unsigned long long v) {
+    if (ls->len + 10 > LEDGER_BLOCK_SIZE) stream_flush(ls);
+    put_varint(ls->raw, &ls->len, v);
+}
+
+void stream_put_signed(LedgerStream *ls, long long v) {
+    stream_put(ls, ((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63));
+}
+
+void stream_put_delta(LedgerStream *ls, int field, int v) {
+    stream_put_signed(ls, (long long)v - ls->prev[field]);
+    ls->prev[field] = v;
+}
+
+void stream_put_cents(LedgerStream *ls, double amount) {
+    stream_put_signed(ls, to_cents(amount));
+}
+
+void stream_put_str(LedgerStream *ls, const char *str) {
+    int n = strlen(str);
+    stream_put(ls, n);
+    for (int i = 0; i < n; i++) {
+        if (ls->len == LEDGER_BLOCK_SIZE) stream_flush(ls);
+        ls->raw[ls->len++] = str[i];
+    }
+}
+
+// Short strings from a small vocabulary: 0 + text the first time, then their dictionary slot.
+void stream_put_word(LedgerStream *ls, const char *str) {
+    for (int i = 0; i < ls->dict_size; i++)
+        if (strcmp(ls->dict[i], str) == 0) { stream_put(ls, i + 1); return; }
+    stream_put(ls, 0);
+    stream_put_str(ls, str);
+    if (ls->dict_size < MAX_DICT) strncpy(ls->dict[ls->dict_size++], str, 31);
+}
+
+// Refills raw with the next block; returns 0 at end of file or on a bad block.
+int stream_fill(LedgerStream *ls) {
+    static unsigned char comp[LEDGER_BLOCK_SIZE * 2];
+    unsigned long long raw_len = 0, comp_len = 0;
+    int c, shift;
+    for (int field = 0; field < 2; field++) {
+        unsigned long long v = 0;
+        for (shift = 0; (c = fgetc(ls->f)) != EOF; shift += 7) {
+            v |= (unsigned long long)(c & 0x7f) << shift;
+            if (!(c & 0x80)) break;
+        }
+        if (c == EOF) return 0;
+        if (field == 0) raw_len = v; else comp_len = v;
+    }
+    if (raw_len > LEDGER_BLOCK_SIZE || comp_len > sizeof(comp)) return 0;
+    if (comp_len == 0) {
+        ls->len = fread(ls->raw, 1, raw_len, ls->f);
+    } else {
+        if (fread(comp, 1, comp_len, ls->f) != comp_len) return 0;
+        ls->len = lz_decompress(comp, comp_len, ls->raw, LEDGER_BLOCK_SIZE);
+    }
+    ls->pos = 0;
+    return ls->len == (int)raw_len;
+}
+
+unsigned long long stream_get(LedgerStream *ls) {
+    unsigned long long v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (ls->pos == ls->len && !stream_fill(ls)) { ls->cut = 1; return 0; }
+        unsigned char c = ls->raw[ls->pos++];
+        v |= (unsigned long long)(c & 0x7f) << shift;
+        if (!(c & 0x80)) break;
+    }
+    return v;
+}
+
+long long stream_get_signed(LedgerStream *ls) {
+    unsigned long long v = stream_get(ls);
+    return (long long)(v >> 1) ^ -(long long)(v & 1);
+}
+
+int stream_get_delta(LedgerStream *ls, int field) {
+    return ls->prev[field] += (int)stream_get_signed(ls);
+}
+
+double stream_get_cents(LedgerStream *ls) {
+    return stream_get_signed(ls) / 100.0;
+}
+
+void stream_get_str(LedgerStream *ls, char *out, int size) {
+    int n = (int)stream_get(ls);
+    for (int i = 0; i < n; i++) {
+        if (ls->pos == ls->len && !stream_fill(ls)) break;
+        char c = ls->raw[ls->pos++];
+        if (i < size - 1) out[i] = c;
+    }
+    out[n < size - 1 ? n : size - 1] = 0;
+}
+
+void stream_get_word(LedgerStream *ls, char *out, int size) {
+    int code = (int)stream_get(ls);
+    if (code == 0) {
+        stream_get_str(ls, out, size);
+        if (ls->dict_size < MAX_DICT) strncpy(ls->dict[ls->dict_size++], out, 31);
+    } else {
+        strncpy(out, code <= ls->dict_size ? ls->dict[code - 1] : "", size - 1);
+        out[size - 1] = 0;
+    }
+}
+
+// Flushes f all the way to disk before closing it. Returns 0 if any step failed.
+int close_durably(FILE *f) {
+    int ok = fflush(f) == 0;
+#ifndef _WIN32
+    ok = fsync(fileno(f)) == 0 && ok;
+#endif
+    return fclose(f) == 0 && ok;
+}
+
+// Makes every file written so far durable with one call, instead of an fsync per file.
+int sync_files() {
+#if defined(__linux__)
+    int fd = open(".", O_RDONLY), ok = fd >= 0 && syncfs(fd) == 0;
+    if (fd >= 0) close(fd);
+    return ok;
+#elif !defined(_WIN32)
+    sync();
+    return 1;
+#else
+    return 1;
+#endif
+}
+
+// Swaps a fully written temporary file into place so readers see the old or the new file, never half of one.
+int replace_file(const char *tmp, const char *path) {
+#ifdef _WIN32
+    remove(path);
+#endif
+    return rename(tmp, path) == 0;
+}
+
+// Binary counterpart of write_group_rows: ids and dates are delta-coded varints, amounts are cents.
+int save_ledger_bin(const char *filename, int gid, int *rows) {
+    static LedgerStream ls;
+    int n[5] = {0};
+    memset(&ls, 0, sizeof(ls));
+    if (!(ls.f = fopen(filename, "wb"))) return 0;
+    fwrite(LEDGER_MAGIC, 1, 4, ls.f);
+    for (int i = 0; i < num_expenses; i++) {
+        Expense *e = &expenses[i];
+        if (gid && e->group_id != gid) continue;
+        stream_put(&ls, e->roster_id ? REC_EQUAL_EXPENSE : REC_EXPENSE);
+        stream_put_delta(&ls, D_EXPENSE_ID, e->id);
+        stream_put_delta(&ls, D_GROUP, e->group_id);
+        stream_put_delta(&ls, D_USER, e->paid_by_user_id);
+        stream_put_cents(&ls, e->amount);
+        stream_put_str(&ls, e->description);
+        stream_put_delta(&ls, D_DATE, date_key(e->date));
+        stream_put_word(&ls, e->split_type);
+        stream_put_word(&ls, e->category);
+        if (e->roster_id) stream_put(&ls, e->roster_id);
+        n[0]++;
+    }
+    for (int i = 0; i < num_splits; i++) {
+        int e = find_expense_index(splits[i].expense_id);
+        if (gid && (e < 0 || expenses[e].group_id != gid)) continue;
+        stream_put(&ls, REC_SPLIT);
+        stream_put_delta(&ls, D_SPLIT_EXPENSE, splits[i].expense_id);
+        stream_put_delta(&ls, D_SPLIT_USER, splits[i].user_id);
+        stream_put_cents(&ls, splits[i].amount);
+        n[1]++;
+    }
+    for (int i = 0; i < num_settlements; i++) {
+        Settlement *st = &settlements[i];
+        if (gid && st->group_id != gid) continue;
+        stream_put(&ls, REC_SETTLEMENT);
+        stream_put_delta(&ls, D_SETTLEMENT_ID, st->id);
+        stream_put_delta(&ls, D_USER, st->payer_id);
+        stream_put_delta(&ls, D_USER, st->receiver_id);
+        stream_put_cents(&ls, st->amount);
+        stream_put_delta(&ls, D_GROUP, st->group_id);
+        stream_put_delta(&ls, D_DATE, date_key(st->date));
+        n[2]++;
+    }
+    for (int i = 0; i < num_recurring; i++) {
+        Recurring *r = &recurring[i];
+        if (gid && r->group_id != gid) continue;
+        stream_put(&ls, REC_RECURRING);
+        stream_put(&ls, r->id);
+        stream_put_delta(&ls, D_GROUP, r->group_id);
+        stream_put_delta(&ls, D_USER, r->paid_by_user_id);
+        stream_put_cents(&ls, r->amount);
+        stream_put_str(&ls, r->description);
+        stream_put_word(&ls, r->category);
+        stream_put_word(&ls, r->frequency);
+        stream_put_delta(&ls, D_DATE, date_key(r->start_date));
+        stream_put(&ls, date_key(r->end_date));
+        stream_put(&ls, r->member_count);
+        for (int j = 0; j < r->member_count; j++)
+            stream_put_signed(&ls, r->member_ids[j] - (j ? r->member_ids[j-1] : 0));
+        n[3]++;
+    }
+    for (int i = 0; i < num_openings; i++) {
+        Opening *o = &openings[i];
+        if (gid && o->group_id != gid) continue;
+        stream_put(&ls, REC_OPENING);
+        stream_put_delta(&ls, D_GROUP, o->group_id);
+        stream_put_delta(&ls, D_USER, o->debtor_id);
+        stream_put_delta(&ls, D_USER, o->creditor_id);
+        stream_put_cents(&ls, o->amount);
+        stream_put_delta(&ls, D_DATE, date_key(o->date));
+        n[4]++;
+    }
+    stream_put(&ls, REC_END);
+    stream_flush(&ls);
+    // Not synced here: save_store syncs all the files of a save at once.
+    if (fflush(ls.f) != 0) { fclose(ls.f); return 0; }
+    if (fclose(ls.f) != 0) return 0;
+    if (rows) memcpy(rows, n, sizeof(n));
+    return 1;
+}
+
+// Appends the rows of a binary ledger to the tables, decoding block by block. Returns 0 if absent.
+// One decoded binary ledger record; the field matching the record type is filled in.
+typedef struct {
+    Expense expense;
+    Split split;
+    Settlement settlement;
+    Recurring recurring; // member_ids is malloc'd and owned by the caller
+    Opening opening;
+} LedgerRecord;
+
+// Opens a binary ledger for read_ledger_record; returns 0 if it can't be read or isn't one.
+int open_ledger_bin(LedgerStream *ls, const char *filename) {
+    char magic[4];
+    memset(ls, 0, sizeof(*ls));
+    if (!(ls->f = fopen(filename, "rb"))) return 0;
+    if (fread(magic, 1, 4, ls->f) != 4 || memcmp(magic, LEDGER_MAGIC, 4) != 0) {
+        printf("%s is not a ledger file.\n", filename);
+        fclose(ls->f);
+        return 0;
+    }
+    return 1;
+}
+
+// Decodes the next record. Returns its type, REC_END at the end, or -1 for a damaged record.
+int read_ledger_record(LedgerStream *ls, LedgerRecord *rec) {
+    int type = (int)stream_get(ls);
+    if (type == REC_EXPENSE || type == REC_EQUAL_EXPENSE) {
+        Expense *e = &rec->expense;
+        memset(e, 0, sizeof(*e));
+        e->id = stream_get_delta(ls, D_EXPENSE_ID);
+        e->group_id = stream_get_delta(ls, D_GROUP);
+        e->paid_by_user_id = stream_get_delta(ls, D_USER);
+        e->amount = stream_get_cents(ls);
+        stream_get_str(ls, e->description, sizeof(e->description));
+        key_to_date(stream_get_delta(ls, D_DATE), e->date);
+        stream_get_word(ls, e->split_type, sizeof(e->split_type));
+        stream_get_word(ls, e->category, sizeof(e->category));
+        if (type == REC_EQUAL_EXPENSE) e->roster_id = (int)stream_get(ls);
+        return REC_EXPENSE;
+    } else if (type == REC_SPLIT) {
+        Split *sp = &rec->split;
+        sp->expense_id = stream_get_delta(ls, D_SPLIT_EXPENSE);
+        sp->user_id = stream_get_delta(ls, D_SPLIT_USER);
+        sp->amount = stream_get_cents(ls);
+    } else if (type == REC_SETTLEMENT) {
+        Settlement *st = &rec->settlement;
+        memset(st, 0, sizeof(*st));
+        st->id = stream_get_delta(ls, D_SETTLEMENT_ID);
+        st->payer_id = stream_get_delta(ls, D_USER);
+        st->receiver_id = stream_get_delta(ls, D_USER);
+        st->amount = stream_get_cents(ls);
+        st->group_id = stream_get_delta(ls, D_GROUP);
+        key_to_date(stream_get_delta(ls, D_DATE), st->date);
+    } else if (type == REC_RECURRING) {
+        Recurring *r = &rec->recurring;
+        memset(r, 0, sizeof(*r));
+        r->id = (int)stream_get(ls);
+        r->group_id = stream_get_delta(ls, D_GROUP);
+        r->paid_by_user_id = stream_get_delta(ls, D_USER);
+        r->amount = stream_get_cents(ls);
+        stream_get_str(ls, r->description, sizeof(r->description));
+        stream_get_word(ls, r->category, sizeof(r->category));
+        stream_get_word(ls, r->frequency, sizeof(r->frequency));
+        key_to_date(stream_get_delta(ls, D_DATE), r->start_date);
+        key_to_date((int)stream_get(ls), r->end_date);
+        r->member_count = (int)stream_get(ls);
+        r->member_ids = malloc((r->member_count ? r->member_count : 1) * sizeof(int));
+        for (int j = 0; j < r->member_count; j++)
+            r->member_ids[j] = (j ? r->member_ids[j-1] : 0) + (int)stream_get_signed(ls);
+    } else if (type == REC_OPENING) {
+        Opening *o = &rec->opening;
+        memset(o, 0, sizeof(*o));
+        o->group_id = stream_get_delta(ls, D_GROUP);
+        o->debtor_id = stream_get_delta(ls, D_USER);
+        o->creditor_id = stream_get_delta(ls, D_USER);
+        o->amount = stream_get_cents(ls);
+        key_to_date(stream_get_delta(ls, D_DATE), o->date);
+    } else if (type != REC_END) {
+        return -1;
+    }
+    return ls->cut ? -1 : type;
+}
+
+int load_ledger_bin(const char *filename) {
+    static LedgerStream ls;
+    static LedgerRecord rec;
+    if (!open_ledger_bin(&ls, filename)) return 0;
+    int type;
+    while ((type = read_ledger_record(&ls, &rec)) != REC_END) {
+        if (type == REC_EXPENSE) {
+            if (num_expenses < MAX_EXPENSES) expenses[num_expenses++] = rec.expense;
+            if (rec.expense.id >= next_expense_id) next_expense_id = rec.expense.id + 1;
+        } else if (type == REC_SPLIT) {
+            if (num_splits < MAX_SPLITS) splits[num_splits++] = rec.split;
+        } else if (type == REC_SETTLEMENT) {
+            if (num_settlements < MAX_SETTLEMENTS) settlements[num_settlements++] = rec.settlement;
+            if (rec.settlement.id >= next_settlement_id) next_settlement_id = rec.settlement.id + 1;
+        } else if (type == REC_RECURRING) {
+            Recurring *r = &rec.recurring;
+            if (num_recurring < MAX_RECURRING && r->member_count > 0) recurring[num_recurring++] = *r;
+            else free(r->member_ids);
+            if (r->id >= next_recurring_id) next_recurring_id = r->id + 1;
+        } else if (type == REC_OPENING) {
+            if (num_openings < MAX_OPENINGS) openings[num_openings++] = rec.opening;
+        } else {
+            printf("%s is damaged; stopped reading early.\n", filename);
+            break;
+        }
+    }
+    fclose(ls.f);
+    return 1;
+}
+
+size_t loaded_bytes(int expense_rows, int split_rows, int settlement_rows) {
+    return expense_rows * sizeof(Expense) + split_rows * sizeof(Split) + settlement_rows * sizeof(Settlement);
+}
+
+// Marks a group's rows as changed: they need saving and any cached balances are stale.
+void touch_group(int gidx) {
+    shards[gidx].dirty = 1;
+    group_versions[gidx]++;
+}
+
+// Name of a group's shard file at a generation. Generation 0 is the name used before shards had generations.
+void shard_file(char *path, size_t size, int gid, int gen) {
+    if (gen) snprintf(path, size, SHARD_GEN_FILE_FMT, gid, gen);
+    else snprintf(path, size, SHARD_FILE_FMT, gid);
+}
+
+// Shard files replaced by the last save; they go once that save is known to be on disk.
+ShardFile retired_shards[MAX_GROUPS];
+int num_retired_shards = 0;
+
+// Writes a group's rows to the file of its next generation. The directory file keeps naming the
+// current one until save_store switches over, so a crash before then still finds the last save whole.
+int save_shard(int gidx) {
+    char path[64];
+    shard_file(path, sizeof(path), groups[gidx].id, shards[gidx].gen + 1);
+    if (!save_ledger_bin(path, groups[gidx].id, shards[gidx].rows)) {
+        printf("Could not write %s\n", path);
+        return 0;
+    }
+    shards[gidx].dirty = 0;
+    shards[gidx].pending = 1;
+    return 1;
+}
+
+// Writes the queued feed records to the log and the FIFO, once the changes they describe are saved.
+void flush_feed() {
+    if (!feed_queue_len) return;
+    if (!feed_log && (feed_log = fopen(FEED_LOG, "a"))) {
+        if (feed_log_torn) fputc('\n', feed_log);
+        feed_log_torn = 0;
+    }
+    if (feed_log) {
+        fwrite(feed_queue, 1, feed_queue_len, feed_log);
+        fflush(feed_log);
+    }
+#ifndef _WIN32
+    if (feed_fd < 0) feed_fd = open(FEED_FIFO, O_WRONLY | O_NONBLOCK);
+    // Record by record, so a full pipe or a departed consumer only drops the live copy from there on;
+    // the log still has it.
+    for (char *rec = feed_queue, *end; feed_fd >= 0 && rec < feed_queue + feed_queue_len; rec = end) {
+        end = memchr(rec, '\n', feed_queue + feed_queue_len - rec) + 1;
+        if (write(feed_fd, rec, end - rec) != end - rec) { close(feed_fd); feed_fd = -1; }
+    }
+#endif
+    feed_queue_len = 0;
+}
+
+// Forgets the queued records of changes that were not saved, and reuses their sequence numbers.
+void drop_feed() {
+    if (feed_queue_len) next_feed_seq = feed_queue_seq;
+    feed_queue_len = 0;
+}
+
+// Commits every change since the last save as a unit: changed groups get new shard files, a single sync
+// makes them and the new directory file durable, and renaming the directory file switches over. The ids
+// handed out (NEXT) therefore always match the shards the directory file names. Returns 0 on failure.
+int commit_store() {
+    for (int g = 0; g < num_groups; g++)
+        if (shards[g].loaded && shards[g].dirty && !save_shard(g)) return 0;
+    FILE *f = fopen(DIR_FILE ".tmp", "w");
+    if (!f) { printf("Could not write %s\n", DIR_FILE); return 0; }
+    write_users_groups(f);
+    for (int g = 0; g < num_groups; g++)
+        fprintf(f, "SHARD|%d|%d|%d|%d|%d|%d|%d\n", groups[g].id, shards[g].rows[0], shards[g].rows[1],
+                shards[g].rows[2], shards[g].rows[3], shards[g].rows[4], shards[g].gen + shards[g].pending);
+    fprintf(f, "NEXT|%d|%d|%d\n", next_expense_id, next_settlement_id, next_recurring_id);
+    fprintf(f, "FEED|%ld\n", next_feed_seq);
+    int ok = fflush(f) == 0;
+    if (fclose(f) != 0 || !ok || !sync_files()) { printf("Could not write %s\n", DIR_FILE); return 0; }
+    // The sync also made the previous save's rename durable, so the files it replaced are unreferenced.
+    for (int i = 0; i < num_retired_shards; i++) {
+        char path[64];
+        shard_file(path, sizeof(path), retired_shards[i].group_id, retired_shards[i].gen);
+        remove(path);
+        if (!retired_shards[i].gen) {
+            snprintf(path, sizeof(path), TEXT_SHARD_FILE_FMT, retired_shards[i].group_id);
+            remove(path);
+        }
+    }
+    num_retired_shards = 0;
+    if (!replace_file(DIR_FILE ".tmp", DIR_FILE)) { printf("Could not write %s\n", DIR_FILE); return 0; }
+    for (int g = 0; g < num_groups; g++)
+        if (shards[g].pending) {
+            retired_shards[num_retired_shards++] = (ShardFile){groups[g].id, shards[g].gen++};
+            shards[g].pending = 0;
+        }
+    return 1;
+}
+
+// Saves the store, then publishes the change records of what was saved. When the save fails those
+// records are dropped, so feed consumers never see a change that isn't on disk.
+void save_store() {
+    if (commit_store()) flush_feed();
+    else drop_feed();
+}
+
+// Drops a group's rows from memory, writing them back first if they changed.
+void evict_group(int gidx) {
+    int gid = groups[gidx].id, n = 0;
+    if (shards[gidx].dirty) save_shard(gidx);
+    for (int i = 0; i < num_splits; i++) {
+        int e = find_expense_index(splits[i].expense_id);
+        if (e < 0 || expenses[e].group_id != gid) splits[n++] = splits[i];
+    }
+    num_splits = n; n = 0;
+    for (int i = 0; i < num_expenses; i++)
+        if (expenses[i].group_id != gid) expenses[n++] = expenses[i];
+    num_expenses = n; n = 0;
+    for (int i = 0; i < num_settlements; i++)
+        if (settlements[i].group_id != gid) settlements[n++] = settlements[i];
+    num_settlements = n; n = 0;
+    for (int i = 0; i < num_recurring; i++) {
+        if (recurring[i].group_id != gid) recurring[n++] = recurring[i];
+        else free(recurring[i].member_ids);
+    }
+    num_recurring = n; n = 0;
+    for (int i = 0; i < num_openings; i++)
+        if (openings[i].group_id != gid) openings[n++] = openings[i];
+    num_openings = n;
+    shards[gidx].loaded = 0;
+    rebuild_indexes();
+}
+
+// Whether rows[] (expenses, splits, settlements, recurring, openings) more rows fit the tables, and
+// with budget set, also SHARD_MEMORY_BUDGET.
+int rows_fit(const int *rows, int budget) {
+    return (!budget || loaded_bytes(num_expenses + rows[0], num_splits + rows[1], num_settlements + rows[2])
+                           <= SHARD_MEMORY_BUDGET) &&
+           num_expenses + rows[0] <= MAX_EXPENSES && num_splits + rows[1] <= MAX_SPLITS &&
+           num_settlements + rows[2] <= MAX_SETTLEMENTS && num_recurring + rows[3] <= MAX_RECURRING &&
+           num_openings + rows[4] <= MAX_OPENINGS;
+}
+
+int evictions_paused = 0; // set while an operation needs every loaded group to stay loaded
+
+// Evicts the least recently used loaded group other than keep; returns 0 if there is none.
+int evict_lru(int keep) {
+    int lru = -1;
+    if (evictions_paused) return 0;
+    for (int g = 0; g < num_groups; g++)
+        if (g != keep && shards[g].loaded && (lru < 0 || shards[g].last_used < shards[lru].last_used)) lru = g;
+    if (lru < 0) return 0;
+    evict_group(lru);
+    return 1;
+}
+
+// Evicts other groups until rows[] more rows can be added to group gidx within the tables and the memory
+// budget, or nothing is left to evict. Callers still check the table they add to.
+void make_room(int gidx, const int *rows) {
+    while (!rows_fit(rows, 1) && evict_lru(gidx)) {}
+}
+
+// Reads a group's shard, evicting least recently used groups first when evict is set.
+int load_group_shard(int gidx, int evict) {
+    Shard *sh = &shards[gidx];
+    while (evict && !rows_fit(sh->rows, 1) && evict_lru(gidx)) {}
+    if (!rows_fit(sh->rows, 0)) {
+        printf("Not enough room to load group '%s'.\n", groups[gidx].name);
+        return 0;
+    }
+    int e0 = num_expenses, s0 = num_splits, st0 = num_settlements, r0 = num_recurring, o0 = num_openings;
+    char path[64];
+    shard_file(path, sizeof(path), groups[gidx].id, sh->gen + sh->pending);
+    if (!load_ledger_bin(path) && !sh->gen && !sh->pending) {
+        snprintf(path, sizeof(path), TEXT_SHARD_FILE_FMT, groups[gidx].id);
+        load_data(path);
+    }
+    if (!index_rows_from(e0, s0, st0, r0, o0)) {
+        drop_rows_from(e0, s0, st0, r0, o0);
+        printf("Pair debt limit reached; group '%s' was not loaded.\n", groups[gidx].name);
+        return 0;
+    }
+    *sh = (Shard){1, 0, ++shard_clock, {num_expenses - e0, num_splits - s0, num_settlements - st0, num_recurring - r0,
+                                        num_openings - o0}, sh->gen, sh->pending};
+    return 1;
+}
+
+// Index of the group with its shard loaded, or -1 after printing why it can't be used.
+int open_group(int gid) {
+    int gidx = find_group_index(gid);
+    if (gidx < 0) { printf("Group not found.\n"); return -1; }
+    if (!shards[gidx].loaded && !load_group_shard(gidx, 1)) return -1;
+    shards[gidx].last_used = ++shard_clock;
+    return gidx;
+}
+
+// Loads every group for ledger-wide queries; returns 0 if some did not fit.
+int open_all_groups() {
+    int ok = 1;
+    for (int g = 0; g < num_groups; g++)
+        if (!shards[g].loaded && !load_group_shard(g, 0)) ok = 0;
+    return ok;
+}
+
+// Queues one change record ("<seq>|ADD|..." or "<seq>|REMOVE|..."). The next save_store appends it
+// to the feed log and pushes it to a live consumer, if one is attached to the FIFO.
+void publish(const char *fmt, ...) {
+    char rec[MAX_LINE];
+    va_list ap;
+    int n = snprintf(rec, sizeof(rec), "%ld|", next_feed_seq++);
+    va_start(ap, fmt);
+    n += vsnprintf(rec + n, sizeof(rec) - n, fmt, ap);
+    va_end(ap);
+    if (n > (int)sizeof(rec) - 2) n = sizeof(rec) - 2;
+    rec[n++] = '\n';
+    if (!feed_queue_len) feed_queue_seq = next_feed_seq - 1;
+    if (feed_queue_len + n > feed_queue_cap) {
+        feed_queue_cap = feed_queue_cap * 2 > feed_queue_len + n ? feed_queue_cap * 2 : feed_queue_len + n + 4096;
+        feed_queue = realloc(feed_queue, feed_queue_cap);
+    }
+    memcpy(feed_queue + feed_queue_len, rec, n);
+    feed_queue_len += n;
+}
+
+void publish_expense(int eidx, int first_split, int split_count) {
+    Expense *e = &expenses[eidx];
+    publish("ADD|EXPENSE|%d|%d|%d|%.2lf|%s|%s|%s|%s", e->id, e->group_id, e->paid_by_user_id, e->amount,
+            e->description, e->date, e->split_type, e->category);
+    for (int i = first_split; i < first_split + split_count; i++)
+        publish("ADD|SPLIT|%d|%d|%.2lf", splits[i].expense_id, splits[i].user_id, splits[i].amount);
+    // Consumers see implicit equal splits as ordinary split records.
+    const Roster *r = expense_roster(eidx);
+    for (int i = 0; r && i < r->member_count; i++)
+        publish("ADD|SPLIT|%d|%d|%.2lf", e->id, r->member_ids[i], equal_share(e->amount, r->member_count, i));
+}
+
+void publish_settlement(int sidx) {
+    Settlement *st = &settlements[sidx];
+    publish("ADD|SETTLEMENT|%d|%d|%d|%.2lf|%d|%s", st->id, st->payer_id, st->receiver_id, st->amount,
+            st->group_id, st->date);
+}
+
+// Prints the logged records after seq; returns the last sequence number seen.
+long replay_feed(long after) {
+    FILE *f = fopen(FEED_LOG, "r");
+    if (!f) return after;
+    char line[MAX_LINE];
+    while (fgets(line, sizeof(line), f)) {
+        long seq = atol(line);
+        if (seq > after) { fputs(line, stdout); after = seq; }
+    }
+    fclose(f);
+    fflush(stdout);
+    return after;
+}
+
+// Consumer side of the change feed: catch up from the log, then optionally stream live records.
+int run_feed(long after, int follow) {
+#ifdef _WIN32
+    replay_feed(after);
+    if (follow) printf("Live feed is not supported on this platform.\n");
+#else
+    int rfd = -1, wfd = -1;
+    if (follow) {
+        // Attach to the FIFO before reading the log, so nothing published meanwhile is missed.
+        if (mkfifo(FEED_FIFO, 0600) < 0 && errno != EEXIST) { perror(FEED_FIFO); return 1; }
+        rfd = open(FEED_FIFO, O_RDONLY | O_NONBLOCK);
+        wfd = open(FEED_FIFO, O_WRONLY); // keeps reads blocking between producer runs
+        if (rfd < 0 || wfd < 0) { perror(FEED_FIFO); return 1; }
+        fcntl(rfd, F_SETFL, 0);
+    }
+    after = replay_feed(after);
+    if (!follow) return 0;
+    FILE *p = fdopen(rfd, "r");
+    char line[MAX_LINE];
+    while (fgets(line, sizeof(line), p)) {
+        long seq = atol(line);
+        if (seq > after + 1) after = replay_feed(after); // live copies were dropped; the log has them
+        if (seq <= after) continue;
+        fputs(line, stdout);
+        fflush(stdout);
+        after = seq;
+    }
+    close(wfd);
+#endif
+    return 0;
+}
+
+// Records are logged only after the save that includes them, but logs written by older versions can be
+// ahead of the saved counter: continue after the log's last complete record.
+void seed_feed_seq() {
+    static char tail[MAX_LINE];
+    FILE *f = fopen(FEED_LOG, "rb");
+    if (!f) return;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f), n = size < MAX_LINE - 1 ? size : MAX_LINE - 1;
+    fseek(f, size - n, SEEK_SET);
+    n = (long)fread(tail, 1, n, f);
+    fclose(f);
+    tail[n] = 0;
+    feed_log_torn = n > 0 && tail[n-1] != '\n';
+    char *end = strrchr(tail, '\n'); // end of the last complete record
+    if (!end) return;
+    *end = 0;
+    char *last = strrchr(tail, '\n');
+    if (!last && n < size) return; // the read started inside that record
+    long seq = atol(last ? last + 1 : tail);
+    if (seq >= next_feed_seq) next_feed_seq = seq + 1;
+}
+
+void load_store() {
+    FILE *f = fopen(DIR_FILE, "r");
+    seed_feed_seq();
+    if (f) {
+        fclose(f);
+        load_data(DIR_FILE);
+        // Files the last save replaced, in case it exited before removing them.
+        for (int g = 0; g < num_groups; g++)
+            if (shards[g].gen) retired_shards[num_retired_shards++] = (ShardFile){groups[g].id, shards[g].gen - 1};
+        return;
+    }
+    // No directory yet: read the single-file ledger and write it out sharded on the next save.
+    load_data(DATA_FILE);
+    if (!rebuild_indexes()) printf("Pair debt limit reached; some balances are incomplete.\n");
+    for (int g = 0; g < num_groups; g++)
+        shards[g] = (Shard){1, 1, ++shard_clock, {0}, 0, 0};
+}
+
+void print_users() {
+    printf("Users:\n");
+    for (int i = 0; i < num_users; i++)
+        printf("  %d: %s\n", users[i].id, users[i].name);
+}
+
+// Returns the new user's id, or -1 after printing why it was rejected.
+int add_user(const char *name) {
+    if (num_users >= MAX_USERS) {
+        printf("User limit reached!\n");
+        return -1;
+    }
+    if(strlen(name) == 0) {
+        printf("Name cannot be empty.\n");
+        return -1;
+    }
+    if (find_user_by_name(name) >= 0) {
+        printf("User with this name already exists.\n");
+        return -1;
+    }
+    users[num_users].id = num_users ? users[num_users - 1].id + 1 : 1;
+    strncpy(users[num_users].name, name, 63);
+    index_user(num_users++);
+    publish("ADD|USER|%d|%s", users[num_users-1].id, users[num_users-1].name);
+    return users[num_users-1].id;
+}
+
+void add_user_interactive() {
+    if (num_users >= MAX_USERS) {
+        printf("User limit reached!\n");
+        return;
+    }
+    char name[64];
+    printf("Enter user name: ");
+    fgets(name, sizeof(name), stdin);
+    if (add_user(trim(name)) >= 0) printf("User added!\n");
+}
+
+int remove_user_from_group(int gid, int uid) {
+    int gidx = find_group_index(gid);
+    if (gidx < 0 || !group_remove_member(&groups[gidx], uid)) return 0;
+    group_versions[gidx]++;
+    return 1;
+}
+
+// Like parse_member_ids, but each entry may also be a user name or prefix. Returns -1 if one does not resolve.
+int resolve_member_ids(char *s, Group *g) {
+    int count = 0;
+    char *tok = strtok(s, ",");
+    while (tok) {
+        int uid = resolve_user(trim(tok));
+        if (uid < 0) return -1;
+        count += group_add_member(g, uid);
+        tok = strtok(NULL, ",");
+    }
+    return count;
+}
+
+// members is a comma-separated list of user ids or names and is modified. Returns the new group's id or -1.
+int add_group(const char *name, char *members) {
+    if (num_groups >= MAX_GROUPS) {
+        printf("Group limit reached!\n");
+        return -1;
+    }
+    if(strlen(name)==0) {
+        printf("Group name cannot be empty.\n");
+        return -1;
+    }
+    if (find_group_by_name(name) >= 0) {
+        printf("Group with this name already exists.\n");
+        return -1;
+    }
+    groups[num_groups] = (Group){num_groups ? groups[num_groups - 1].id + 1 : 1, "", NULL, 0, 0};
+    int count = resolve_member_ids(members, &groups[num_groups]);
+    if(count<0) return -1;
+    if(count==0) { printf("No members specified.\n"); return -1; }
+    strncpy(groups[num_groups].name, name, 63);
+    index_group(num_groups++);
+    publish("ADD|GROUP|%d|%s", groups[num_groups-1].id, groups[num_groups-1].name);
+    for (int i = 0; i < groups[num_groups-1].member_count; i++)
+        publish("ADD|MEMBER|%d|%d", groups[num_groups-1].id, groups[num_groups-1].member_ids[i]);
+    return groups[num_groups-1].id;
+}
+
+void add_group_interactive() {
+    if (num_groups >= MAX_GROUPS) {
+        printf("Group limit reached!\n");
+        return;
+    }
+    char name[64], members[MAX_LINE];
+    printf("Enter group name: ");
+    fgets(name, sizeof(name), stdin);
+    strcpy(name, trim(name));
+    if(strlen(name)==0) {
+        printf("Group name cannot be empty.\n");
+        return;
+    }
+    if (find_group_by_name(name) >= 0) {
+        printf("Group with this name already exists.\n");
+        return;
+    }
+    print_users();
+    printf("Enter comma-separated user IDs or names for this group: ");
+    fgets(members, sizeof(members), stdin);
+    if (add_group(name, trim(members)) >= 0) printf("Group added!\n");
+}
+
+void print_groups() {
+    printf("Groups:\n");
+    for (int i = 0; i < num_groups; i++) {
+        printf("  %d: %s (members: ", groups[i].id, groups[i].name);
+        for (int j = 0; j < groups[i].member_count; j++)
+            printf("%s%s", user_name(groups[i].member_ids[j]), (j+1==groups[i].member_count?"":", "));
+        printf(")\n");
+    }
+}
+
+void add_remove_user_group() {
+    print_groups();
+    int gid = read_group_id("Enter group ID or name: ");
+    if (gid < 0) return;
+    int gidx = find_group_index(gid);
+    if(gidx<0) { printf("Group not found.\n"); return; }
+    printf("1. Add user\n2. Remove user\nChoice: ");
+    int ch;
+    scanf("%d", &ch); getchar();
+    if(ch==1) {
+        print_users();
+        int uid = read_user_id("Enter user ID or name to add: ");
+        if (uid < 0) return;
+        if (find_user_index(uid) < 0) { printf("User not found.\n"); return; }
+        if(!group_add_member(&groups[gidx], uid)) {
+            printf("User already in group.\n"); return;
+        }
+        group_versions[gidx]++;
+        publish("ADD|MEMBER|%d|%d", gid, uid);
+        printf("User added to group.\n");
+    } else if(ch==2) {
+        int uid = read_user_id("Enter user ID or name to remove: ");
+        if (uid < 0) return;
+        if (remove_user_from_group(gid, uid)) publish("REMOVE|MEMBER|%d|%d", gid, uid);
+        printf("User removed from group.\n");
+    }
+}
+
+// Records an expense and its splits. "custom" splits take one share per group member, in
+// member order. Returns the new expense id, or -1 after printing why it was rejected.
+int add_expense(int gid, int paid_by, double amt, const char *desc, const char *cat, const char *date,
+                const char *stype, const double *shares) {
+    int gidx = open_group(gid);
+    if (gidx < 0) return -1;
+    make_room(gidx, (int[5]){1, groups[gidx].member_count, 0, 0, 0});
+    if (num_expenses >= MAX_EXPENSES) {
+        printf("Expense limit reached!\n");
+        return -1;
+    }
+    if(!group_has_member(&groups[gidx], paid_by)) { printf("User not in group.\n"); return -1; }
+    if (amt <= 0) {
+        printf("Amount must be positive.\n");
+        return -1;
+    }
+    if (!is_valid_date(date)) {
+        printf("Invalid date format. Use DD-MM-YYYY.\n");
+        return -1;
+    }
+    int eid = next_expense_id;
+    expenses[num_expenses] = (Expense){eid, gid, paid_by, amt, "", "", "", "", 0};
+    strncpy(expenses[num_expenses].description, desc, 127);
+    strncpy(expenses[num_expenses].date, date, 15);
+    strncpy(expenses[num_expenses].split_type, stype, 15);
+    strncpy(expenses[num_expenses].category, cat, 31);
+    num_expenses++;
+    int s0 = num_splits;
+    // Equal splits are stored as a reference to the group's roster, unless the roster table is full.
+    if (strcmp(stype, "equal") == 0 && !(expenses[num_expenses-1].roster_id = current_roster(gidx))) {
+        if (num_splits + groups[gidx].member_count > MAX_SPLITS) {
+            printf("Split limit reached!\n");
+            num_expenses--;
+            return -1;
+        }
+        for (int i = 0; i < groups[gidx].member_count; i++)
+            splits[num_splits++] = (Split){eid, groups[gidx].member_ids[i],
+                                           equal_share(amt, groups[gidx].member_count, i)};
+    } else if (strcmp(stype, "custom") == 0) {
+        double total = 0;
+        if (num_splits + groups[gidx].member_count > MAX_SPLITS) {
+            printf("Split limit reached!\n");
+            num_expenses--;
+            return -1;
+        }
+        for (int i = 0; i < groups[gidx].member_count; i++) {
+            splits[num_splits++] = (Split){eid, groups[gidx].member_ids[i], shares[i]};
+            total += shares[i];
+        }
+        if (total != amt) {
+            printf("Error: Custom split does not sum to total amount! Expense not added.\n");
+            num_expenses--;
+            num_splits -= groups[gidx].member_count;
+            return -1;
+        }
+    }
+    int indexed = index_expense(num_expenses - 1);
+    for (int i = s0; indexed && i < num_splits; i++)
+        indexed = index_split(num_expenses - 1, i);
+    if (!indexed) {
+        drop_rows_from(num_expenses - 1, s0, num_settlements, num_recurring, num_openings);
+        printf("Pair debt limit reached!\n");
+        return -1;
+    }
+    next_expense_id++;
+    touch_group(gidx);
+    publish_expense(num_expenses - 1, s0, num_splits - s0);
+    return eid;
+}
+
+void add_expense_interactive() {
+    int gid, paid_by, gidx = -1;
+    double amt;
+    char desc[128], date[16], stype[16], cat[32];
+    print_groups();
+    gid = read_group_id("Enter group ID or name: ");
+    if (gid < 0) return;
+    gidx = open_group(gid);
+    if (gidx < 0) return;
+    make_room(gidx, (int[5]){1, groups[gidx].member_count, 0, 0, 0});
+    if (num_expenses >= MAX_EXPENSES) {
+        printf("Expense limit reached!\n");
+        return;
+    }
+    paid_by = read_user_id("Who paid? Enter user ID or name: ");
+    if (paid_by < 0) return;
+    if(!group_has_member(&groups[gidx], paid_by)) { printf("User not in group.\n"); return; }
+    printf("Enter amount: ");
+    scanf("%lf", &amt); getchar();
+    if (amt <= 0) {
+        printf("Amount must be positive.\n");
+        return;
+    }
+    printf("Description: ");
+    fgets(desc, sizeof(desc), stdin); strcpy(desc, trim(desc));
+    printf("Category: ");
+    fgets(cat, sizeof(cat), stdin); strcpy(cat, trim(cat));
+    printf("Date (DD-MM-YYYY): ");
+    fgets(date, sizeof(date), stdin); strcpy(date, trim(date));
+    if (!is_valid_date(date)) {
+        printf("Invalid date format. Use DD-MM-YYYY.\n");
+        return;
+    }
+    printf("Split type (equal/custom): ");
+    fgets(stype, sizeof(stype), stdin); strcpy(stype, trim(stype));
+    double *shares = NULL;
+    if (strcmp(stype, "custom") == 0) {
+        if (num_splits + groups[gidx].member_count > MAX_SPLITS) {
+            printf("Split limit reached!\n");
+            return;
+        }
+        shares = malloc(groups[gidx].member_count * sizeof(double));
+        for (int i = 0; i < groups[gidx].member_count; i++) {
+            printf("Enter amount for %s: ", user_name(groups[gidx].member_ids[i]));
+            scanf("%lf", &shares[i]); getchar();
+            if(shares[i] < 0) {
+                printf("Amount must be non-negative.\n");
+                i--; continue;
+            }
+        }
+    }
+    if (add_expense(gid, paid_by, amt, desc, cat, date, stype, shares) >= 0) printf("Expense added!\n");
+    free(shares);
+}
+
+void print_expense(int i) {
+    int gidx = find_group_index(expenses[i].group_id);
+    printf("%d: Group: %s, Paid by: %s, Amount: %.2lf, Desc: %s, Date: %s, Cat: %s, Split: %s\n",
+        expenses[i].id, gidx < 0 ? "?" : groups[gidx].name, user_name(expenses[i].paid_by_user_id),
+        expenses[i].amount, expenses[i].description, expenses[i].date, expenses[i].category, expenses[i].split_type);
+}
+
+void add_recurring_interactive() {
+    int gid, paid_by, gidx;
+    double amt;
+    char desc[128], cat[32], freq[16], start[16], end[16];
+    print_groups();
+    gid = read_group_id("Enter group ID or name: ");
+    if (gid < 0) return;
+    gidx = open_group(gid);
+    if (gidx < 0) return;
+    make_room(gidx, (int[5]){0, 0, 0, 1, 0});
+    if (num_recurring >= MAX_RECURRING) {
+        printf("Recurring expense limit reached!\n");
+        return;
+    }
+    paid_by = read_user_id("Who pays? Enter user ID or name: ");
+    if (paid_by < 0) return;
+    if(!group_has_member(&groups[gidx], paid_by)) { printf("User not in group.\n"); return; }
+    printf("Amount per occurrence: ");
+    scanf("%lf", &amt); getchar();
+    if (amt <= 0) {
+        printf("Amount must be positive.\n");
+        return;
+    }
+    printf("Description: ");
+    fgets(desc, sizeof(desc), stdin); strcpy(desc, trim(desc));
+    printf("Category: ");
+    fgets(cat, sizeof(cat), stdin); strcpy(cat, trim(cat));
+    printf("Frequency (weekly/monthly): ");
+    fgets(freq, sizeof(freq), stdin); strcpy(freq, trim(freq));
+    if (strcmp(freq, "weekly") != 0 && strcmp(freq, "monthly") != 0) {
+        printf("Frequency must be weekly or monthly.\n");
+        return;
+    }
+    printf("Start date (DD-MM-YYYY): ");
+    fgets(start, sizeof(start), stdin); strcpy(start, trim(start));
+    printf("End date (DD-MM-YYYY, blank for none): ");
+    fgets(end, sizeof(end), stdin); strcpy(end, trim(end));
+    if (!is_valid_date(start) || (strlen(end) > 0 && !is_valid_date(end))) {
+        printf("Invalid date format. Use DD-MM-YYYY.\n");
+        return;
+    }
+    Recurring *r = &recurring[num_recurring];
+    *r = (Recurring){next_recurring_id, gid, paid_by, amt, "", "", "", "", "", NULL, 0};
+    strncpy(r->description, desc, 127);
+    strncpy(r->category, cat, 31);
+    strncpy(r->frequency, freq, 15);
+    strncpy(r->start_date, start, 15);
+    strncpy(r->end_date, end, 15);
+    r->member_count = groups[gidx].member_count;
+    r->member_ids = malloc(r->member_count * sizeof(int));
+    memcpy(r->member_ids, groups[gidx].member_ids, r->member_count * sizeof(int));
+    if (!index_recurring(num_recurring++)) {
+        drop_rows_from(num_expenses, num_splits, num_settlements, num_recurring - 1, num_openings);
+        printf("Pair debt limit reached!\n");
+        return;
+    }
+    next_recurring_id++;
+    touch_group(gidx);
+    publish("ADD|RECURRING|%d|%d|%d|%.2lf|%s|%s|%s|%s|%s", r->id, r->group_id, r->paid_by_user_id, r->amount,
+            r->description, r->category, r->frequency, r->start_date, r->end_date[0] ? r->end_date : "-");
+    printf("Recurring expense added!\n");
+}
+
+void print_expenses() {
+    if (!open_all_groups()) printf("(some groups could not be loaded)\n");
+    for (int i = 0; i < num_expenses; i++)
+        print_expense(i);
+}
+
+// One page of expenses of group_id (0 for every group) in sort order, limited to sort keys in [lo, hi].
+// A cursor from an earlier page continues that listing; the cursor for the following page is written
+// to next, or "" after the last page. Returns 0 if the cursor is not valid.
+int list_expenses(int sort, int group_id, long long lo, long long hi, const char *cursor, char *next) {
+    long long last_key = lo;
+    int last_id = INT_MIN;
+    *next = 0;
+    if (cursor && *cursor) {
+        unsigned long long h, k;
+        if (sscanf(cursor, "%d.%d.%llx.%llx.%x", &sort, &group_id, &h, &k, (unsigned *)&last_id) != 5 ||
+            sort < 0 || sort >= SORT_KEYS) {
+            printf("Invalid cursor.\n");
+            return 0;
+        }
+        hi = (long long)h;
+        last_key = (long long)k;
+        last_id++; // resume after the last row shown
+    }
+    const ExpenseOrder *o;
+    if (group_id) {
+        int gidx = open_group(group_id);
+        if (gidx < 0) return 0;
+        o = &expense_orders[gidx][sort];
+    } else {
+        if (!open_all_groups()) printf("(some groups could not be loaded)\n");
+        o = &expense_orders[MAX_GROUPS][sort];
+    }
+    int i = order_lower_bound(o, sort, last_key, last_id), shown = 0;
+    for (; i < o->count && shown < LIST_PAGE_SIZE && expense_sort_key(o->items[i], sort) <= hi; i++, shown++)
+        print_expense(o->items[i]);
+    if (!shown) printf("No expenses found.\n");
+    if (shown && i < o->count && expense_sort_key(o->items[i], sort) <= hi) {
+        int e = o->items[i - 1];
+        sprintf(next, "%d.%d.%llx.%llx.%x", sort, group_id, (unsigned long long)hi,
+                (unsigned long long)expense_sort_key(e, sort), (unsigned)expenses[e].id);
+    }
+    return 1;
+}
+
+// Key bounds for a listing filter: a date range, an amount range in cents, or one payer (0 for all).
+void sort_key_range(int sort, long long from, long long to, long long *lo, long long *hi) {
+    *lo = LLONG_MIN;
+    *hi = LLONG_MAX;
+    if (sort == SORT_PAYER) {
+        if (from) { *lo = from << 32; *hi = *lo | 0xffffffffLL; }
+        return;
+    }
+    if (from) *lo = from;
+    if (to) *hi = to;
+}
+
+// Prints the expenses of one group that contain every word and fall in [from_day, to_day]. The shortest
+// posting list is walked from its first posting on from_day, up to to_day, and the others are merged against it.
+int search_group(int group_id, char words[][MAX_TOKEN_LEN], int n, int from_day, int to_day) {
+    Token *lists[MAX_QUERY_TOKENS];
+    for (int i = 0; i < n; i++) {
+        int t = find_token(group_id, words[i], 0);
+        if (t < 0) return 0;
+        lists[i] = &tokens[t];
+    }
+    for (int i = 1; i < n; i++)
+        for (int j = i; j > 0 && lists[j]->count < lists[j-1]->count; j--) {
+            Token *tmp = lists[j]; lists[j] = lists[j-1]; lists[j-1] = tmp;
+        }
+    Posting first = {from_day ? from_day : INT_MIN, -1};
+    int pos[MAX_QUERY_TOKENS], found = 0;
+    for (int i = 0; i < n; i++) pos[i] = posting_lower_bound(lists[i], &first);
+    for (int k = pos[0]; k < lists[0]->count; k++) {
+        const Posting *p = &lists[0]->postings[k];
+        if (to_day && p->day > to_day) break;
+        int all = 1;
+        for (int i = 1; i < n && all; i++) {
+            while (pos[i] < lists[i]->count && compare_postings(&lists[i]->postings[pos[i]], p) < 0) pos[i]++;
+            all = pos[i] < lists[i]->count && lists[i]->postings[pos[i]].expense == p->expense;
+        }
+        if (!all) continue;
+        print_expense(p->expense);
+        found++;
+    }
+    return found;
+}
+
+// Expenses whose description or category contain every word of the query, by group and then date.
+// group_id 0 and a zero day bound mean no filter.
+void search_expenses(const char *query, int group_id, int from_day, int to_day) {
+    char words[MAX_QUERY_TOKENS][MAX_TOKEN_LEN];
+    int n = tokenize(query, words, MAX_QUERY_TOKENS), found = 0;
+    if (n == 0) { printf("Enter at least one word to search for.\n"); return; }
+    if (group_id && open_group(group_id) < 0) return;
+    if (!group_id && !open_all_groups()) printf("(some groups could not be loaded)\n");
+    for (int g = 0; g < num_groups; g++)
+        if (!group_id || groups[g].id == group_id) found += search_group(groups[g].id, words, n, from_day, to_day);
+    if (!found) printf("No matching expenses.\n");
+    else printf("%d matching expense(s).\n", found);
+}
+
+// Largest k (at most TOP_K) expenses in a group, or overall when group_id is 0.
+void print_top_expenses(int group_id, int k) {
+    ExpenseHeap *h = &overall_top;
+    if (!group_id && !open_all_groups()) printf("(some groups could not be loaded)\n");
+    if (group_id) {
+        int gidx = open_group(group_id);
+        if (gidx < 0) return;
+        h = &group_top[gidx];
+    }
+    int items[TOP_K], n = h->count;
+    memcpy(items, h->items, n * sizeof(int));
+    for (int i = 1; i < n; i++)
+        for (int j = i; j > 0 && expenses[items[j]].amount > expenses[items[j-1]].amount; j--) {
+            int tmp = items[j]; items[j] = items[j-1]; items[j-1] = tmp;
+        }
+    if (k > n) k = n;
+    if (k < 0) k = 0;
+    printf("Top %d expense(s):\n", k);
+    for (int i = 0; i < k; i++)
+        print_expense(items[i]);
+}
+
+// Users who paid the most in a group (0 = all) and month (YYYYMM, 0 = all time).
+void print_top_spenders(int group_id, int month, int k) {
+    int top[TOP_K], n = 0; // user indices, kept in descending order of total
+    double total[TOP_K];
+    if (k > TOP_K) k = TOP_K;
+    if (group_id && open_group(group_id) < 0) return;
+    if (!group_id && !open_all_groups()) printf("(some groups could not be loaded)\n");
+    for (int u = 0; u < num_users && k > 0; u++) {
+        SpendTotal *t = find_spend_total(month, group_id, users[u].id, 0);
+        if (!t || t->total <= 0 || (n == k && t->total <= total[n-1])) continue;
+        int i = n < k ? n++ : n - 1;
+        for (; i > 0 && total[i-1] < t->total; i--) {
+            top[i] = top[i-1]; total[i] = total[i-1];
+        }
+        top[i] = u; total[i] = t->total;
+    }
+    printf("Top %d spender(s):\n", n);
+    for (int i = 0; i < n; i++)
+        printf("  %s: %.2lf\n", users[top[i]].name, total[i]);
+}
+
+void print_group_expenses(int group_id) {
+    if (open_group(group_id) < 0) return;
+    for (int i = 0; i < num_expenses; i++) {
+        if (expenses[i].group_id == group_id) {
+            printf("%d: Paid by: %s, Amount: %.2lf, Desc: %s, Date: %s, Cat: %s, Split: %s\n",
+                expenses[i].id, user_name(expenses[i].paid_by_user_id), expenses[i].amount, expenses[i].description,
+                expenses[i].date, expenses[i].category, expenses[i].split_type);
+        }
+    }
+    char today[16], date[16];
+    today_date(today);
+    for (int i = 0; i < num_recurring; i++) {
+        Recurring *r = &recurring[i];
+        if (r->group_id != group_id) continue;
+        int n = recurring_count(r, today);
+        for (int k = 0; k < n; k++) {
+            recurring_date(r, k, date);
+            printf("R%d: Paid by: %s, Amount: %.2lf, Desc: %s, Date: %s, Cat: %s, Split: %s (equal)\n",
+                r->id, user_name(r->paid_by_user_id), r->amount, r->description, date, r->category, r->frequency);
+        }
+    }
+    for (int i = 0; i < num_openings; i++) {
+        Opening *o = &openings[i];
+        if (o->group_id != group_id) continue;
+        if (o->debtor_id) printf("Opening balance as of %s: %s owes %s %.2lf\n", o->date, user_name(o->debtor_id),
+                                 user_name(o->creditor_id), o->amount);
+        else printf("Opening balance as of %s: %s %+.2lf\n", o->date, user_name(o->creditor_id), o->amount);
+    }
+}
+
+// Returns the group's balances, recomputing them only if the group changed or the day rolled over.
+const BalanceCache *group_balances(int gidx) {
+    int group_id = groups[gidx].id, mcount = groups[gidx].member_count;
+    char today[16];
+    today_date(today);
+    BalanceCache *c = &balance_cache[gidx];
+    if (c->balance && c->version == group_versions[gidx] && c->day == date_to_days(today)) return c;
+    c->version = group_versions[gidx];
+    c->day = date_to_days(today);
+    c->balance = realloc(c->balance, (mcount + 1) * sizeof(double));
+    c->suggestions = realloc(c->suggestions, (mcount * 2 + 1) * sizeof(Suggestion));
+    c->suggestion_count = 0;
+    double *balance = c->balance;
+
+    for (int i = 0; i < mcount; i++) {
+        int uid = groups[gidx].member_ids[i];
+        balance[i] = 0;
+        for (int j = 0; j < num_expenses; j++)
+            if (expenses[j].group_id == group_id && expenses[j].paid_by_user_id == uid)
+                balance[i] += expenses[j].amount;
+        for (int j = 0; j < num_splits; j++)
+            if (splits[j].user_id == uid) {
+                for (int k = 0; k < num_expenses; k++)
+                    if (splits[j].expense_id == expenses[k].id && expenses[k].group_id == group_id)
+                        balance[i] -= splits[j].amount;
+            }
+        for (int j = 0; j < num_settlements; j++) {
+            if (settlements[j].group_id == group_id) {
+                if (settlements[j].payer_id == uid) balance[i] += settlements[j].amount;
+                if (settlements[j].receiver_id == uid) balance[i] -= settlements[j].amount;
+            }
+        }
+    }
+    for (int j = 0; j < num_expenses; j++) {
+        const Roster *r = expenses[j].group_id == group_id ? expense_roster(j) : NULL;
+        for (int k = 0; r && k < r->member_count; k++)
+            if (group_has_member(&groups[gidx], r->member_ids[k]))
+                balance[group_member_pos(&groups[gidx], r->member_ids[k])] -= equal_share(expenses[j].amount, r->member_count, k);
+    }
+    for (int i = 0; i < mcount; i++)
+        balance[i] += recurring_balance(group_id, groups[gidx].member_ids[i], today);
+    for (int j = 0; j < num_openings; j++) {
+        if (openings[j].group_id != group_id) continue;
+        const Group *g = &groups[gidx];
+        int debtor = openings[j].debtor_id, creditor = openings[j].creditor_id;
+        if (group_has_member(g, debtor)) balance[group_member_pos(g, debtor)] -= openings[j].amount;
+        if (group_has_member(g, creditor)) balance[group_member_pos(g, creditor)] += openings[j].amount;
+    }
+    // Round to whole cents that still add up to the rounded total (largest remainders round up), then
+    // match in cents, so recording every suggestion leaves each balance at exactly zero.
+    long long *working = malloc((mcount + 1) * sizeof(long long)), deficit = 0;
+    double *remainder = malloc((mcount + 1) * sizeof(double)), sum = 0;
+    for (int i = 0; i < mcount; i++) {
+        double x = balance[i] * 100;
+        working[i] = (long long)x;
+        if (working[i] > x) working[i]--;
+        remainder[i] = x - working[i];
+        sum += balance[i];
+        deficit -= working[i];
+    }
+    for (deficit += to_cents(sum); deficit > 0; deficit--) {
+        int best = 0;
+        for (int i = 1; i < mcount; i++)
+            if (remainder[i] > remainder[best]) best = i;
+        working[best]++;
+        remainder[best] = -1;
+    }
+    for (int i = 0; i < mcount; i++) balance[i] = working[i] / 100.0;
+    free(remainder);
+    for (int loop = 0; loop < mcount*2; loop++) {
+        int min_idx = -1, max_idx = -1;
+        for (int i = 0; i < mcount; i++) {
+            if (min_idx == -1 || working[i] < working[min_idx])
+                if (working[i] < 0) min_idx = i;
+            if (max_idx == -1 || working[i] > working[max_idx])
+                if (working[i] > 0) max_idx = i;
+        }
+        if (min_idx == -1 || max_idx == -1) break;
+        long long amt = -working[min_idx] < working[max_idx] ? -working[min_idx] : working[max_idx];
+        c->suggestions[c->suggestion_count++] =
+            (Suggestion){groups[gidx].member_ids[min_idx], groups[gidx].member_ids[max_idx], amt / 100.0};
+        working[min_idx] += amt;
+        working[max_idx] -= amt;
+    }
+    free(working);
+    return c;
+}
+
+void print_balances(int group_id) {
+    int gidx = open_group(group_id);
+    if (gidx < 0) return;
+    const BalanceCache *c = group_balances(gidx);
+    printf("Balances for group '%s':\n", groups[gidx].name);
+    for (int i = 0; i < groups[gidx].member_count; i++)
+        printf("  %s: %.2lf\n", user_name(groups[gidx].member_ids[i]), c->balance[i]);
+    printf("Suggested settlements:\n");
+    for (int i = 0; i < c->suggestion_count; i++)
+        printf("  %s pays %s: %.2lf\n", user_name(c->suggestions[i].payer_id),
+                                         user_name(c->suggestions[i].receiver_id), c->suggestions[i].amount);
+}
+
+void print_pair_debts(int group_id, int user_id) {
+    int gidx = open_group(group_id);
+    if (gidx < 0) return;
+    char today[16];
+    today_date(today);
+    printf("Who owes whom in group '%s':\n", groups[gidx].name);
+    for (int i = 0; i < groups[gidx].member_count; i++) {
+        int uid = groups[gidx].member_ids[i];
+        if (user_id && uid != user_id) continue;
+        int h = find_pair_head(group_id, uid, 0);
+        for (int p = h < 0 ? -1 : pair_heads[h].first; p >= 0; ) {
+            int is_lo = pairs[p].lo_id == uid;
+            int other = is_lo ? pairs[p].hi_id : pairs[p].lo_id;
+            double owes = (is_lo ? pairs[p].amount : -pairs[p].amount) + recurring_pair_debt(group_id, uid, other, today);
+            // Without a user filter each pair is shown once, from the debtor's side.
+            if (owes >= 0.005) printf("  %s owes %s: %.2lf\n", user_name(uid), user_name(other), owes);
+            else if (user_id && owes <= -0.005) printf("  %s owes %s: %.2lf\n", user_name(other), user_name(uid), -owes);
+            p = is_lo ? pairs[p].next_lo : pairs[p].next_hi;
+        }
+    }
+}
+
+// One page of a user's shares in a group between two days (0 = unbounded); returns the page count.
+int print_shares(int group_id, int user_id, int from_day, int to_day, int page) {
+    if (open_group(group_id) < 0) return 0;
+    int h = find_pair_head(group_id, user_id, 0);
+    if (h < 0) { printf("No shares found.\n"); return 0; }
+    const PairHead *p = &pair_heads[h];
+    int first = from_day ? shares_before(p, from_day) : 0;
+    int end = to_day ? shares_before(p, to_day + 1) : p->share_count;
+    if (end <= first) { printf("No shares found.\n"); return 0; }
+    int pages = (end - first + SHARES_PAGE_SIZE - 1) / SHARES_PAGE_SIZE;
+    double total = 0;
+    printf("Shares of %s, page %d of %d:\n", user_name(user_id), page + 1, pages);
+    for (int i = first + page * SHARES_PAGE_SIZE; i < end && i < first + (page + 1) * SHARES_PAGE_SIZE; i++) {
+        int e = share_expense(p->shares[i]);
+        double amount = share_amount(p->shares[i], user_id);
+        printf("  %s  %-24s %8.2lf of %8.2lf  (paid by %s)\n", expenses[e].date, expenses[e].description,
+               amount, expenses[e].amount, user_name(expenses[e].paid_by_user_id));
+        total += amount;
+    }
+    printf("  Page total: %.2lf\n", total);
+    return pages;
+}
+
+void print_balances_as_of(int group_id, const char *date) {
+    int gidx = open_group(group_id);
+    if (gidx < 0) return;
+    int day = date_to_days(date);
+    printf("Balances for group '%s' as of %s:\n", groups[gidx].name, date);
+    for (int i = 0; i < groups[gidx].member_count; i++) {
+        int uid = groups[gidx].member_ids[i];
+        printf("  %s: %.2lf\n", user_name(uid), timeline_balance(gidx, uid, day) + recurring_balance(group_id, uid, date));
+    }
+}
+
+void balances_menu() {
+    print_groups();
+    int gid = read_group_id("Enter group ID or name: ");
+    if (gid < 0) return;
+    print_balances(gid);
+}
+
+void group_expenses_menu() {
+    print_groups();
+    int gid = read_group_id("Enter group ID or name: ");
+    if (gid < 0) return;
+    print_group_expenses(gid);
+}
+
+void pair_debts_menu() {
+    print_groups();
+    int gid = read_group_id("Enter group ID or name: ");
+    if (gid < 0) return;
+    int uid = read_user_id("Enter user ID or name (0 for everyone): ");
+    if (uid < 0) return;
+    print_pair_debts(gid, uid);
+}
+
+void balances_as_of_menu() {
+    print_groups();
+    int gid = read_group_id("Enter group ID or name: ");
+    if (gid < 0) return;
+    printf("As of date (DD-MM-YYYY): ");
+    char date[16]; fgets(date, sizeof(date), stdin); strcpy(date, trim(date));
+    if (!is_valid_date(date)) {
+        printf("Invalid date format. Use DD-MM-YYYY.\n");
+        return;
+    }
+    print_balances_as_of(gid, date);
+}
+
+// Reads an optional DD-MM-YYYY date; returns 0 for a blank line, -1 if invalid.
+int read_optional_day(const char *prompt) {
+    char date[16];
+    printf("%s", prompt);
+    fgets(date, sizeof(date), stdin); strcpy(date, trim(date));
+    if (strlen(date) == 0) return 0;
+    if (!is_valid_date(date)) {
+        printf("Invalid date format. Use DD-MM-YYYY.\n");
+        return -1;
+    }
+    return date_to_days(date);
+}
+
+void shares_menu() {
+    print_groups();
+    int gid = read_group_id("Enter group ID or name: ");
+    if (gid < 0) return;
+    int uid = read_user_id("Enter user ID or name: ");
+    if (uid < 0) return;
+    int from = read_optional_day("From date (DD-MM-YYYY, blank for none): ");
+    if (from < 0) return;
+    int to = read_optional_day("To date (DD-MM-YYYY, blank for none): ");
+    if (to < 0) return;
+    char answer[16];
+    for (int page = 0; page + 1 < print_shares(gid, uid, from, to, page); page++) {
+        printf("Enter for the next page, q to stop: ");
+        fgets(answer, sizeof(answer), stdin);
+        if (tolower((unsigned char)answer[0]) == 'q') break;
+    }
+}
+
+void list_menu() {
+    print_groups();
+    int gid = read_group_id("Enter group ID or name (0 for all groups): ");
+    if (gid < 0) return;
+    printf("Sort by 1. Date 2. Amount 3. Payer: ");
+    int sort;
+    scanf("%d", &sort); getchar();
+    if (sort < 1 || sort > SORT_KEYS) { printf("Invalid choice.\n"); return; }
+    sort--;
+    long long from = 0, to = 0, lo, hi;
+    if (sort == SORT_DATE) {
+        if ((from = read_optional_day("From date (DD-MM-YYYY, blank for none): ")) < 0) return;
+        if ((to = read_optional_day("To date (DD-MM-YYYY, blank for none): ")) < 0) return;
+    } else if (sort == SORT_AMOUNT) {
+        char amount[32];
+        printf("Minimum amount (blank for none): ");
+        fgets(amount, sizeof(amount), stdin);
+        if (*trim(amount)) from = to_cents(atof(amount));
+        printf("Maximum amount (blank for none): ");
+        fgets(amount, sizeof(amount), stdin);
+        if (*trim(amount)) to = to_cents(atof(amount));
+    } else {
+        if ((from = read_user_id("Payer user ID or name (0 for all): ")) < 0) return;
+    }
+    sort_key_range(sort, from, to, &lo, &hi);
+    char cursor[64] = "", next[64], answer[16];
+    while (list_expenses(sort, gid, lo, hi, cursor, next) && *next) {
+        printf("Enter for the next page, q to stop: ");
+        fgets(answer, sizeof(answer), stdin);
+        if (tolower((unsigned char)answer[0]) == 'q') break;
+        strcpy(cursor, next);
+    }
+}
+
+void search_menu() {
+    char query[128];
+    printf("Search for: ");
+    fgets(query, sizeof(query), stdin); strcpy(query, trim(query));
+    int gid = read_group_id("Group ID or name (0 for all groups): ");
+    if (gid < 0) return;
+    int from = read_optional_day("From date (DD-MM-YYYY, blank for none): ");
+    if (from < 0) return;
+    int to = read_optional_day("To date (DD-MM-YYYY, blank for none): ");
+    if (to < 0) return;
+    search_expenses(query, gid, from, to);
+}
+
+void top_expenses_menu() {
+    print_groups();
+    int gid = read_group_id("Enter group ID or name (0 for all groups): ");
+    if (gid < 0) return;
+    printf("How many (up to %d): ", TOP_K);
+    int k;
+    scanf("%d", &k); getchar();
+    print_top_expenses(gid, k);
+}
+
+void top_spenders_menu() {
+    print_groups();
+    int gid = read_group_id("Enter group ID or name (0 for all groups): ");
+    if (gid < 0) return;
+    printf("How many (up to %d): ", TOP_K);
+    int k;
+    scanf("%d", &k); getchar();
+    char month[16];
+    printf("Month (MM-YYYY, blank for all time): ");
+    fgets(month, sizeof(month), stdin); strcpy(month, trim(month));
+    int key = 0;
+    if (strlen(month) > 0) {
+        char date[sizeof(month) + 3]; // "01-" and the whole month, so a long entry isn't cut to a valid date
+        snprintf(date, sizeof(date), "01-%s", month);
+        if (!is_valid_date(date)) {
+            printf("Invalid month format. Use MM-YYYY.\n");
+            return;
+        }
+        key = month_key(date);
+    }
+    print_top_spenders(gid, key, k);
+}
+
+// Returns the new settlement id, or -1 after printing why it was rejected.
+int add_settlement(int gid, int payer, int receiver, double amt, const char *date) {
+    int gidx = open_group(gid);
+    if(gidx<0) return -1;
+    make_room(gidx, (int[5]){0, 0, 1, 0, 0});
+    if (num_settlements >= MAX_SETTLEMENTS) {
+        printf("Settlement limit reached!\n");
+        return -1;
+    }
+    if (!group_has_member(&groups[gidx], payer) || !group_has_member(&groups[gidx], receiver)) {
+        printf("User not in group.\n");
+        return -1;
+    }
+    if (amt <= 0) {
+        printf("Settlement amount must be positive.\n");
+        return -1;
+    }
+    if (!is_valid_date(date)) {
+        printf("Invalid date format. Use DD-MM-YYYY.\n");
+        return -1;
+    }
+    settlements[num_settlements++] = (Settlement){next_settlement_id, payer, receiver, amt, gid, ""};
+    strncpy(settlements[num_settlements-1].date, date, 15);
+    if (!index_settlement(num_settlements-1)) {
+        drop_rows_from(num_expenses, num_splits, num_settlements - 1, num_recurring, num_openings);
+        printf("Pair debt limit reached!\n");
+        return -1;
+    }
+    next_settlement_id++;
+    touch_group(gidx);
+    publish_settlement(num_settlements-1);
+    return settlements[num_settlements-1].id;
+}
+
+void settlements_menu() {
+    print_groups();
+    int gid = read_group_id("Enter group ID or name: ");
+    if (gid < 0) return;
+    int gidx = open_group(gid);
+    if(gidx<0) return;
+    make_room(gidx, (int[5]){0, 0, 1, 0, 0});
+    if (num_settlements >= MAX_SETTLEMENTS) {
+        printf("Settlement limit reached!\n");
+        return;
+    }
+    print_balances(gid);
+    int payer = read_user_id("Enter payer user ID or name: ");
+    if (payer < 0) return;
+    int receiver = read_user_id("Enter receiver user ID or name: ");
+    if (receiver < 0) return;
+    printf("Enter amount: ");
+    double amt; scanf("%lf", &amt); getchar();
+    if (amt <= 0) {
+        printf("Settlement amount must be positive.\n");
+        return;
+    }
+    printf("Enter date (DD-MM-YYYY): ");
+    char date[16]; fgets(date, sizeof(date), stdin); strcpy(date, trim(date));
+    if (add_settlement(gid, payer, receiver, amt, date) >= 0) printf("Settlement recorded!\n");
+}
+
+// Records every suggested settlement of a group, dated today. Returns how many were recorded, or -1.
+int settle_group(int gid) {
+    int gidx = open_group(gid);
+    if (gidx < 0) return -1;
+    const BalanceCache *c = group_balances(gidx);
+    int n = c->suggestion_count;
+    long long unmatched = 0;
+    for (int i = 0; i < groups[gidx].member_count; i++) unmatched += to_cents(c->balance[i]);
+    make_room(gidx, (int[5]){0, 0, n, 0, 0});
+    if (num_settlements + n > MAX_SETTLEMENTS) {
+        printf("Settlement limit reached!\n");
+        return -1;
+    }
+    // Recording invalidates the cached plan, so work from a copy.
+    Suggestion *plan = malloc((n + 1) * sizeof(Suggestion));
+    if (n > 0) memcpy(plan, c->suggestions, n * sizeof(Suggestion));
+    char today[16];
+    today_date(today);
+    for (int i = 0; i < n; i++)
+        add_settlement(gid, plan[i].payer_id, plan[i].receiver_id, plan[i].amount, today);
+    free(plan);
+    // Only possible with shares recorded before they were split in whole cents.
+    if (unmatched) printf("%s: %.2lf of split rounding is left unsettled.\n", groups[gidx].name, unmatched / 100.0);
+    return n;
+}
+
+// Settles one group, or every group when gid is 0; the caller saves once afterwards. Every group is
+// loaded and the settlements are counted first, so either all of them are recorded or none are, and
+// nothing is evicted (and saved) halfway through.
+int settle_all(int gid) {
+    int total = 0, gidx = gid ? open_group(gid) : -1;
+    if (gid && gidx < 0) return -1;
+    if (!gid && !open_all_groups()) {
+        printf("Not every group fits in memory; nothing was settled.\n");
+        return -1;
+    }
+    for (int g = 0; g < num_groups; g++)
+        if (!gid || groups[g].id == gid) total += group_balances(g)->suggestion_count;
+    if (gid) make_room(gidx, (int[5]){0, 0, total, 0, 0});
+    if (num_settlements + total > MAX_SETTLEMENTS) {
+        printf("Settlement limit reached!\n");
+        return -1;
+    }
+    evictions_paused = 1;
+    for (int g = 0; g < num_groups; g++) {
+        if (gid && groups[g].id != gid) continue;
+        int n = settle_group(groups[g].id);
+        if (n) printf("%s: recorded %d settlement%s.\n", groups[g].name, n, n == 1 ? "" : "s");
+    }
+    evictions_paused = 0;
+    if (!total) printf("Nothing to settle.\n");
+    return total;
+}
+
+void settle_all_menu() {
+    print_groups();
+    int gid = read_group_id("Enter group ID or name (0 for all groups): ");
+    if (gid < 0) return;
+    settle_all(gid);
+}
+
+void settlements_history_menu() {
+    print_groups();
+    int gid = read_group_id("Enter group ID or name: ");
+    if (gid < 0) return;
+    if (open_group(gid) < 0) return;
+    printf("Settlements for this group:\n");
+    for(int i=0; i<num_settlements; ++i) {
+        if(settlements[i].group_id == gid) {
+            printf("%d: %s paid %s %.2lf on %s\n", settlements[i].id, user_name(settlements[i].payer_id),
+                   user_name(settlements[i].receiver_id), settlements[i].amount, settlements[i].date);
+        }
+    }
+}
+
+int compare_pairs(const void *a, const void *b) {
+    const PairDebt *x = a, *y = b;
+    if (x->lo_id != y->lo_id) return x->lo_id < y->lo_id ? -1 : 1;
+    return x->hi_id < y->hi_id ? -1 : x->hi_id > y->hi_id;
+}
+
+// Appends "debtor owes creditor amt" to a contribution list; debtor 0 only credits the creditor.
+void add_contribution(PairDebt *list, int *n, int debtor, int creditor, double amt) {
+    if (debtor == creditor) return;
+    int lo = debtor < creditor ? debtor : creditor, hi = debtor < creditor ? creditor : debtor;
+    list[(*n)++] = (PairDebt){0, lo, hi, debtor == lo ? amt : -amt, -1, -1};
+}
+
+// Moves a group's expenses, splits, settlements and openings dated before cutoff to its archive file and
+// replaces them with one opening entry per member pair, so balances and who owes whom are unchanged.
+// Returns the number of expenses and settlements archived, or -1.
+int archive_group(int gid, const char *cutoff) {
+    int gidx = open_group(gid);
+    if (gidx < 0) return -1;
+    if (!is_valid_date(cutoff)) {
+        printf("Invalid date format. Use DD-MM-YYYY.\n");
+        return -1;
+    }
+    int before = date_to_days(cutoff), n = 0, archived = 0, old_openings = 0, shares = num_splits;
+    for (int i = 0; i < num_expenses; i++)
+        if (expense_roster(i)) shares += expense_roster(i)->member_count;
+    PairDebt *c = malloc((num_expenses + 2 * shares + num_settlements + num_openings + 1) * sizeof(PairDebt));
+    for (int i = 0; i < num_expenses; i++)
+        if (expenses[i].group_id == gid && date_to_days(expenses[i].date) < before) {
+            // The payer is credited the full amount and each share moves from the payer to its debtor;
+            // whatever rounding left between the two stays a one-sided adjustment.
+            int payer = expenses[i].paid_by_user_id;
+            add_contribution(c, &n, 0, payer, expenses[i].amount);
+            const Roster *r = expense_roster(i);
+            for (int k = 0; r && k < r->member_count; k++) {
+                double share = equal_share(expenses[i].amount, r->member_count, k);
+                add_contribution(c, &n, 0, payer, -share);
+                add_contribution(c, &n, r->member_ids[k], payer, share);
+            }
+            archived++;
+        }
+    for (int i = 0; i < num_splits; i++) {
+        int e = find_expense_index(splits[i].expense_id);
+        if (e < 0 || expenses[e].group_id != gid || date_to_days(expenses[e].date) >= before) continue;
+        add_contribution(c, &n, 0, expenses[e].paid_by_user_id, -splits[i].amount);
+        add_contribution(c, &n, splits[i].user_id, expenses[e].paid_by_user_id, splits[i].amount);
+    }
+    for (int i = 0; i < num_settlements; i++)
+        if (settlements[i].group_id == gid && date_to_days(settlements[i].date) < before) {
+            add_contribution(c, &n, settlements[i].receiver_id, settlements[i].payer_id, settlements[i].amount);
+            archived++;
+        }
+    for (int i = 0; i < num_openings; i++)
+        if (openings[i].group_id == gid && date_to_days(openings[i].date) < before) {
+            add_contribution(c, &n, openings[i].debtor_id, openings[i].creditor_id, openings[i].amount);
+            old_openings++;
+        }
+    if (!archived) {
+        free(c);
+        printf("Nothing to archive before %s.\n", cutoff);
+        return 0;
+    }
+    qsort(c, n, sizeof(PairDebt), compare_pairs);
+    // Sum each pair in whole cents, the unit amounts are stored in, so every nonzero residue is kept exactly.
+    int m = 0;
+    for (int i = 0, j; i < n; i = j) {
+        long long cents = 0;
+        for (j = i; j < n && c[j].lo_id == c[i].lo_id && c[j].hi_id == c[i].hi_id; j++) cents += to_cents(c[j].amount);
+        if (cents) { c[m] = c[i]; c[m++].amount = cents / 100.0; }
+    }
+    if (num_openings - old_openings + m > MAX_OPENINGS) {
+        free(c);
+        printf("Opening balance limit reached!\n");
+        return -1;
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), ARCHIVE_FILE_FMT, gid);
+    FILE *f = fopen(path, "a");
+    if (!f) { free(c); printf("Could not write %s\n", path); return -1; }
+    write_group_rows(f, gid, before, NULL);
+    if (!close_durably(f)) { free(c); printf("Could not write %s\n", path); return -1; }
+
+    int k = 0;
+    for (int i = 0; i < num_splits; i++) {
+        int e = find_expense_index(splits[i].expense_id);
+        if (e < 0 || expenses[e].group_id != gid || date_to_days(expenses[e].date) >= before) splits[k++] = splits[i];
+    }
+    num_splits = k; k = 0;
+    for (int i = 0; i < num_expenses; i++)
+        if (expenses[i].group_id != gid || date_to_days(expenses[i].date) >= before) expenses[k++] = expenses[i];
+    num_expenses = k; k = 0;
+    for (int i = 0; i < num_settlements; i++)
+        if (settlements[i].group_id != gid || date_to_days(settlements[i].date) >= before) settlements[k++] = settlements[i];
+    num_settlements = k; k = 0;
+    for (int i = 0; i < num_openings; i++)
+        if (openings[i].group_id != gid || date_to_days(openings[i].date) >= before) openings[k++] = openings[i];
+    num_openings = k;
+
+    char date[16];
+    days_to_date(before - 1, date);
+    publish("ARCHIVE|%d|%s", gid, cutoff);
+    for (int i = 0; i < m; i++) {
+        Opening *o = &openings[num_openings++];
+        if (c[i].lo_id && c[i].amount < 0) *o = (Opening){gid, c[i].hi_id, c[i].lo_id, -c[i].amount, ""};
+        else *o = (Opening){gid, c[i].lo_id, c[i].hi_id, c[i].amount, ""};
+        strcpy(o->date, date);
+        publish("ADD|OPENING|%d|%d|%d|%.2lf|%s", gid, o->debtor_id, o->creditor_id, o->amount, o->date);
+    }
+    free(c);
+    rebuild_indexes();
+    touch_group(gidx);
+    return archived;
+}
+
+void archive_menu() {
+    print_groups();
+    int gid = read_group_id("Enter group ID or name: ");
+    if (gid < 0) return;
+    printf("Archive everything dated before (DD-MM-YYYY): ");
+    char date[16]; fgets(date, sizeof(date), stdin); strcpy(date, trim(date));
+    int n = archive_group(gid, date);
+    if (n > 0) printf("Archived %d expenses and settlements; opening balances carried forward.\n", n);
+}
+
+// Splits s in place on '|', keeping empty fields; returns the field count.
+int split_fields(char *s, char **fields, int max) {
+    int n = 0;
+    while (n < max) {
+        fields[n++] = trim(s);
+        char *bar = strchr(s, '|');
+        if (!bar) break;
+        *bar = 0;
+        s = bar + 1;
+    }
+    return n;
+}
+
+// One batch command: a command name, then '|'-separated arguments. Returns 1 on success.
+int run_batch_command(const char *cmd, char *args) {
+    char *f[9];
+    int n = split_fields(args, f, 9);
+    if (strcmp(cmd, "add-user") == 0 && n == 1)
+        return add_user(f[0]) >= 0;
+    if (strcmp(cmd, "add-group") == 0 && n == 2)
+        return add_group(f[0], f[1]) >= 0;
+    if (strcmp(cmd, "add-expense") == 0 && (n == 7 || n == 8)) {
+        int gid = resolve_group(f[0]), payer = resolve_user(f[1]);
+        if (gid < 0 || payer < 0) return 0;
+        int gidx = open_group(gid);
+        if (gidx < 0) return 0;
+        double *shares = NULL;
+        if (strcmp(f[6], "custom") == 0) {
+            int count = 0;
+            shares = malloc((groups[gidx].member_count + 1) * sizeof(double));
+            for (char *tok = n == 8 ? strtok(f[7], ",") : NULL; tok && count <= groups[gidx].member_count;
+                 tok = strtok(NULL, ","))
+                shares[count++] = atof(tok);
+            if (count != groups[gidx].member_count) {
+                printf("Expected %d custom shares.\n", groups[gidx].member_count);
+                free(shares);
+                return 0;
+            }
+        }
+        int ok = add_expense(gid, payer, atof(f[2]), f[3], f[4], f[5], f[6], shares) >= 0;
+        free(shares);
+        return ok;
+    }
+    if (strcmp(cmd, "settle") == 0 && n == 5) {
+        int gid = resolve_group(f[0]), payer = resolve_user(f[1]), receiver = resolve_user(f[2]);
+        if (gid < 0 || payer < 0 || receiver < 0) return 0;
+        return add_settlement(gid, payer, receiver, atof(f[3]), f[4]) >= 0;
+    }
+    if (strcmp(cmd, "list") == 0 && (n == 1 || n == 4)) {
+        char next[64];
+        long long from = 0, to = 0, lo, hi;
+        int sort = SORT_DATE;
+        if (n == 4) {
+            if (strcmp(f[0], "amount") == 0) sort = SORT_AMOUNT;
+            else if (strcmp(f[0], "payer") == 0) sort = SORT_PAYER;
+            else if (strcmp(f[0], "date") != 0) { printf("Sort by date, amount or payer.\n"); return 0; }
+            if (sort == SORT_DATE) {
+                if ((*f[2] && !is_valid_date(f[2])) || (*f[3] && !is_valid_date(f[3]))) {
+                    printf("Invalid date format. Use DD-MM-YYYY.\n");
+                    return 0;
+                }
+                from = *f[2] ? date_to_days(f[2]) : 0;
+                to = *f[3] ? date_to_days(f[3]) : 0;
+            } else if (sort == SORT_AMOUNT) {
+                from = *f[2] ? to_cents(atof(f[2])) : 0;
+                to = *f[3] ? to_cents(atof(f[3])) : 0;
+            } else if (*f[2] && (from = resolve_user(f[2])) < 0) return 0;
+        }
+        sort_key_range(sort, from, to, &lo, &hi);
+        int gid = n == 4 && *f[1] ? resolve_group(f[1]) : 0;
+        if (gid < 0 || !list_expenses(sort, gid, lo, hi, n == 1 ? f[0] : NULL, next)) return 0;
+        if (*next) printf("Next cursor: %s\n", next);
+        return 1;
+    }
+    if (strcmp(cmd, "settle-all") == 0 && n == 1) {
+        int gid = resolve_group(f[0]);
+        return gid >= 0 && settle_all(gid) >= 0;
+    }
+    if (strcmp(cmd, "archive") == 0 && n == 2) {
+        int gid = resolve_group(f[0]);
+        return gid >= 0 && archive_group(gid, f[1]) >= 0;
+    }
+    if (strcmp(cmd, "balances") == 0 && n == 1) {
+        int gid = resolve_group(f[0]);
+        if (gid < 0) return 0;
+        if (find_group_index(gid) < 0) { printf("Group not found.\n"); return 0; }
+        print_balances(gid);
+        return 1;
+    }
+    printf("Unknown command or wrong number of fields: %s\n", cmd);
+    return 0;
+}
+
+// Splits a trimmed "cmd args" line and runs it.
+int run_batch_line(char *line) {
+    char *args = "", *space = strchr(line, ' ');
+    if (space) { *space = 0; args = space + 1; }
+    return run_batch_command(line, args);
+}
+
+// Applies commands line by line against the in-memory tables, saving every `every` commands
+// (0 = only at the end). Returns the number of lines that failed.
+int run_batch(FILE *in, int every) {
+    char line[MAX_LINE];
+    int lineno = 0, failed = 0, pending = 0;
+    while (fgets(line, sizeof(line), in)) {
+        lineno++;
+        char *cmd = trim(line);
+        if (!*cmd || *cmd == '#') continue;
+        if (!run_batch_line(cmd)) {
+            fprintf(stderr, "line %d: failed\n", lineno);
+            failed++;
+        } else if (every && ++pending >= every) {
+            save_store();
+            pending = 0;
+        }
+    }
+    save_store();
+    return failed;
+}
+
+#ifndef _WIN32
+// Group commit: producer threads queue batch commands, one committer applies them in batches and
+// pays a single save_store() per batch instead of one per command. Batching only shares the save: each
+// command still succeeds or fails on its own, as in --batch. A failed command changes nothing and is
+// reported as source:line, and the rest of its batch is applied and saved. (Commands from different
+// sources share a batch, so rolling a whole batch back would undo other sources' unrelated work.)
+typedef struct {
+    char *line;
+    const char *source;
+    int lineno;
+} IngestItem;
+
+IngestItem ingest_queue[INGEST_QUEUE_CAP];
+int ingest_head = 0, ingest_count = 0, ingest_producers = 0, ingest_failed = 0;
+int ingest_batch_size = 256, ingest_latency_ms = 20;
+long ingest_batches = 0, ingest_commands = 0;
+pthread_mutex_t ingest_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t ingest_not_empty = PTHREAD_COND_INITIALIZER;
+pthread_cond_t ingest_not_full = PTHREAD_COND_INITIALIZER;
+
+void ingest_push(char *line, const char *source, int lineno) {
+    pthread_mutex_lock(&ingest_lock);
+    while (ingest_count == INGEST_QUEUE_CAP) pthread_cond_wait(&ingest_not_full, &ingest_lock);
+    ingest_queue[(ingest_head + ingest_count++) % INGEST_QUEUE_CAP] = (IngestItem){line, source, lineno};
+    pthread_cond_signal(&ingest_not_empty);
+    pthread_mutex_unlock(&ingest_lock);
+}
+
+// Reads one command stream ("-" is stdin) into the queue.
+void *ingest_producer(void *arg) {
+    const char *path = arg;
+    FILE *in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!in) perror(path);
+    else {
+        char line[MAX_LINE];
+        int lineno = 0;
+        while (fgets(line, sizeof(line), in)) {
+            char *cmd = trim(line);
+            lineno++;
+            if (*cmd && *cmd != '#') ingest_push(strdup(cmd), path, lineno);
+        }
+        if (in != stdin) fclose(in);
+    }
+    pthread_mutex_lock(&ingest_lock);
+    ingest_producers--;
+    pthread_cond_signal(&ingest_not_empty);
+    pthread_mutex_unlock(&ingest_lock);
+    return NULL;
+}
+
+// Takes up to ingest_batch_size commands, waiting at most ingest_latency_ms for a batch to fill.
+// Returns 0 once the queue is empty and every producer has finished.
+int ingest_take(IngestItem *batch) {
+    pthread_mutex_lock(&ingest_lock);
+    while (ingest_count == 0 && ingest_producers > 0) pthread_cond_wait(&ingest_not_empty, &ingest_lock);
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ingest_latency_ms / 1000;
+    deadline.tv_nsec += (ingest_latency_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) { deadline.tv_sec++; deadline.tv_nsec -= 1000000000L; }
+    while (ingest_count < ingest_batch_size && ingest_producers > 0)
+        if (pthread_cond_timedwait(&ingest_not_empty, &ingest_lock, &deadline) == ETIMEDOUT) break;
+    int n = ingest_count < ingest_batch_size ? ingest_count : ingest_batch_size;
+    for (int i = 0; i < n; i++) batch[i] = ingest_queue[(ingest_head + i) % INGEST_QUEUE_CAP];
+    ingest_head = (ingest_head + n) % INGEST_QUEUE_CAP;
+    ingest_count -= n;
+    pthread_cond_broadcast(&ingest_not_full);
+    pthread_mutex_unlock(&ingest_lock);
+    return n;
+}
+
+// The only thread that touches the tables while ingesting. Applies each batch command by command, then
+// saves the commands that succeeded in one commit.
+void *ingest_committer(void *arg) {
+    IngestItem *batch = malloc(ingest_batch_size * sizeof(IngestItem));
+    int n;
+    (void)arg;
+    while ((n = ingest_take(batch)) > 0) {
+        for (int i = 0; i < n; i++) {
+            if (!run_batch_line(batch[i].line)) {
+                fprintf(stderr, "%s:%d: failed\n", batch[i].source, batch[i].lineno);
+                ingest_failed++;
+            }
+            free(batch[i].line);
+        }
+        save_store();
+        ingest_batches++;
+        ingest_commands += n;
+    }
+    free(batch);
+    return NULL;
+}
+
+// Runs one producer per source and a committer until all sources are drained. Returns the failed line count.
+int run_ingest(char **sources, int count) {
+    pthread_t committer, *producers = malloc(count * sizeof(pthread_t));
+    ingest_producers = count;
+    pthread_create(&committer, NULL, ingest_committer, NULL);
+    for (int i = 0; i < count; i++) pthread_create(&producers[i], NULL, ingest_producer, sources[i]);
+    for (int i = 0; i < count; i++) pthread_join(producers[i], NULL);
+    pthread_join(committer, NULL);
+    free(producers);
+    fprintf(stderr, "%ld commands in %ld commits, %d failed\n", ingest_commands, ingest_batches, ingest_failed);
+    return ingest_failed;
+}
+#endif
+
+// --check: validates a ledger without loading it into the tables, so files of any size can be checked.
+enum { CHECK_USER = REC_EQUAL_EXPENSE + 1, CHECK_GROUP, CHECK_ROSTER, CHECK_NEXT, CHECK_KINDS };
+
+// A ledger row as the checker sees it; which fields are used depends on the row kind.
+typedef struct {
+    int file; // check_files[] index
+    long line; // line number, or record number in a binary ledger
+    int id; // user, group, expense, settlement or recurring id; a split's expense id
+    int group_id;
+    int user_id; // payer; a split's user
+    int other_id; // settlement receiver; opening debtor; an expense's roster
+    long long cents;
+    char date_ok, needs_splits;
+    int *members; // groups, rosters and recurring templates, sorted
+    int member_count;
+} CheckRow;
+
+typedef struct {
+    int file;
+    long line;
+    char text[160];
+} Violation;
+
+typedef struct {
+    Violation *items;
+    long count, cap;
+} ViolationList;
+
+typedef struct {
+    CheckRow *rows;
+    long count, cap;
+} CheckTable;
+
+const char *check_files[MAX_GROUPS + 2]; int num_check_files = 0;
+CheckTable check_tables[CHECK_KINDS];
+ViolationList check_parse_errors;
+
+void add_violation(ViolationList *v, const CheckRow *r, const char *fmt, ...) {
+    if (v->count == v->cap) {
+        v->cap = v->cap ? v->cap * 2 : 64;
+        v->items = realloc(v->items, v->cap * sizeof(Violation));
     }
-    printf("Description: ");
-    fgets(desc, sizeof(desc), stdin); strcpy(desc, trim(desc));
-    printf("Category: ");
-    fgets(cat, sizeof(cat), stdin); strcpy(cat, trim(cat));
-    printf("Date (DD-MM-YYYY): ");
-    fgets(date, sizeof(date), stdin); strcpy(date, trim(date));
-    if (!is_valid_date(date)) {
-        printf("Invalid date format. Use DD-MM-YYYY.\n");
-        return;
+    Violation *out = &v->items[v->count++];
+    out->file = r->file;
+    out->line = r->line;
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(out->text, sizeof(out->text), fmt, ap);
+    va_end(ap);
+}
+
+CheckRow *add_check_row(int kind, int file, long line) {
+    CheckTable *t = &check_tables[kind];
+    if (t->count == t->cap) {
+        t->cap = t->cap ? t->cap * 2 : 1024;
+        t->rows = realloc(t->rows, t->cap * sizeof(CheckRow));
     }
-    printf("Split type (equal/custom): ");
-    fgets(stype, sizeof(stype), stdin); strcpy(stype, trim(stype));
-    int eid = num_expenses ? expenses[num_expenses - 1].id + 1 : 1;
-    expenses[num_expenses] = (Expense){eid, gid, paid_by, amt, "", "", "", ""};
-    strncpy(expenses[num_expenses].description, desc, 127);
-    strncpy(expenses[num_expenses].date, date, 15);
-    strncpy(expenses[num_expenses].split_type, stype, 15);
-    strncpy(expenses[num_expenses].category, cat, 31);
-    num_expenses++;
-    if (strcmp(stype, "equal") == 0) {
-        if (num_splits + groups[gidx].member_count > MAX_SPLITS) {
-            printf("Split limit reached!\n");
-            num_expenses--;
-            return;
+    CheckRow *r = &t->rows[t->count++];
+    memset(r, 0, sizeof(*r));
+    r->file = file;
+    r->line = line;
+    return r;
+}
+
+void check_members(CheckRow *r, char *s) {
+    Group g = {0};
+    parse_member_ids(s, &g);
+    r->members = g.member_ids;
+    r->member_count = g.member_count;
+}
+
+// Reads a text ledger (data file, directory file or text shard) one line at a time.
+void check_text_file(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) { perror(path); return; }
+    int file = num_check_files++;
+    check_files[file] = path;
+    char line[MAX_LINE], *fld[12];
+    long lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        if (!*trim(line)) continue;
+        int n = split_fields(line, fld, 12);
+        CheckRow *r, where = {file, lineno, 0, 0, 0, 0, 0, 0, 0, NULL, 0};
+        if (strcmp(fld[0], "USER") == 0 && n == 3) {
+            add_check_row(CHECK_USER, file, lineno)->id = atoi(fld[1]);
+        } else if (strcmp(fld[0], "GROUP") == 0 && n == 4) {
+            r = add_check_row(CHECK_GROUP, file, lineno);
+            r->id = atoi(fld[1]);
+            check_members(r, fld[3]);
+        } else if (strcmp(fld[0], "ROSTER") == 0 && n == 4) {
+            r = add_check_row(CHECK_ROSTER, file, lineno);
+            r->id = atoi(fld[1]);
+            r->group_id = atoi(fld[2]);
+            check_members(r, fld[3]);
+        } else if (strcmp(fld[0], "EXPENSE") == 0 && (n == 9 || n == 10)) {
+            int roster = n == 10 ? atoi(fld[9]) : 0;
+            r = add_check_row(REC_EXPENSE, file, lineno);
+            *r = (CheckRow){file, lineno, atoi(fld[1]), atoi(fld[2]), atoi(fld[3]), roster, to_cents(atof(fld[4])),
+                            is_valid_date(fld[6]), !roster && (strcmp(fld[7], "equal") == 0 || strcmp(fld[7], "custom") == 0),
+                            NULL, 0};
+        } else if (strcmp(fld[0], "SPLIT") == 0 && n == 4) {
+            r = add_check_row(REC_SPLIT, file, lineno);
+            *r = (CheckRow){file, lineno, atoi(fld[1]), 0, atoi(fld[2]), 0, to_cents(atof(fld[3])), 1, 0, NULL, 0};
+        } else if (strcmp(fld[0], "SETTLEMENT") == 0 && n == 7) {
+            r = add_check_row(REC_SETTLEMENT, file, lineno);
+            *r = (CheckRow){file, lineno, atoi(fld[1]), atoi(fld[5]), atoi(fld[2]), atoi(fld[3]),
+                            to_cents(atof(fld[4])), is_valid_date(fld[6]), 0, NULL, 0};
+        } else if (strcmp(fld[0], "RECURRING") == 0 && n == 11) {
+            r = add_check_row(REC_RECURRING, file, lineno);
+            *r = (CheckRow){file, lineno, atoi(fld[1]), atoi(fld[2]), atoi(fld[3]), 0, to_cents(atof(fld[4])),
+                            is_valid_date(fld[8]) && (strcmp(fld[9], "-") == 0 || is_valid_date(fld[9])) &&
+                            (strcmp(fld[7], "weekly") == 0 || strcmp(fld[7], "monthly") == 0), 0, NULL, 0};
+            check_members(r, fld[10]);
+        } else if (strcmp(fld[0], "OPENING") == 0 && n == 6) {
+            r = add_check_row(REC_OPENING, file, lineno);
+            *r = (CheckRow){file, lineno, 0, atoi(fld[1]), atoi(fld[3]), atoi(fld[2]), to_cents(atof(fld[4])),
+                            is_valid_date(fld[5]), 0, NULL, 0};
+        } else if (strcmp(fld[0], "NEXT") == 0 && n == 4) {
+            r = add_check_row(CHECK_NEXT, file, lineno);
+            r->id = atoi(fld[1]);
+            r->group_id = atoi(fld[2]);
+            r->user_id = atoi(fld[3]);
+        } else if (!((strcmp(fld[0], "SHARD") == 0 && n >= 6 && n <= 8) || (strcmp(fld[0], "FEED") == 0 && n == 2))) {
+            add_violation(&check_parse_errors, &where, "malformed %s row", fld[0]);
         }
-        double each = amt / groups[gidx].member_count;
-        for (int i = 0; i < groups[gidx].member_count; i++)
-            splits[num_splits++] = (Split){eid, groups[gidx].member_ids[i], each};
-    } else if (strcmp(stype, "custom") == 0) {
-        double total = 0, share;
-        if (num_splits + groups[gidx].member_count > MAX_SPLITS) {
-            printf("Split limit reached!\n");
-            num_expenses--;
-            return;
+    }
+    fclose(f);
+}
+
+// Decodes a binary ledger straight into the check tables, which grow as needed, so a file with more
+// rows than the program's tables hold is still checked whole.
+void check_binary_file(const char *path) {
+    static LedgerStream ls;
+    static LedgerRecord rec;
+    if (!open_ledger_bin(&ls, path)) return;
+    int file = num_check_files++, type;
+    long record = 0;
+    check_files[file] = path;
+    while ((type = read_ledger_record(&ls, &rec)) != REC_END) {
+        record++;
+        if (type == REC_EXPENSE) {
+            Expense *e = &rec.expense;
+            *add_check_row(REC_EXPENSE, file, record) = (CheckRow){file, record, e->id, e->group_id, e->paid_by_user_id,
+                e->roster_id, to_cents(e->amount), is_valid_date(e->date),
+                !e->roster_id && (strcmp(e->split_type, "equal") == 0 || strcmp(e->split_type, "custom") == 0), NULL, 0};
+        } else if (type == REC_SPLIT) {
+            *add_check_row(REC_SPLIT, file, record) = (CheckRow){file, record, rec.split.expense_id, 0, rec.split.user_id,
+                0, to_cents(rec.split.amount), 1, 0, NULL, 0};
+        } else if (type == REC_SETTLEMENT) {
+            Settlement *st = &rec.settlement;
+            *add_check_row(REC_SETTLEMENT, file, record) = (CheckRow){file, record, st->id, st->group_id, st->payer_id,
+                st->receiver_id, to_cents(st->amount), is_valid_date(st->date), 0, NULL, 0};
+        } else if (type == REC_RECURRING) {
+            Recurring *rc = &rec.recurring;
+            *add_check_row(REC_RECURRING, file, record) = (CheckRow){file, record, rc->id, rc->group_id, rc->paid_by_user_id,
+                0, to_cents(rc->amount), is_valid_date(rc->start_date) && (!rc->end_date[0] || is_valid_date(rc->end_date)) &&
+                (strcmp(rc->frequency, "weekly") == 0 || strcmp(rc->frequency, "monthly") == 0), 0, rc->member_ids,
+                rc->member_count};
+        } else if (type == REC_OPENING) {
+            Opening *o = &rec.opening;
+            *add_check_row(REC_OPENING, file, record) = (CheckRow){file, record, 0, o->group_id, o->creditor_id,
+                o->debtor_id, to_cents(o->amount), is_valid_date(o->date), 0, NULL, 0};
+        } else {
+            CheckRow where = {file, record, 0, 0, 0, 0, 0, 0, 0, NULL, 0};
+            add_violation(&check_parse_errors, &where, "damaged record, the rest of the file was not read");
+            break;
         }
-        for (int i = 0; i < groups[gidx].member_count; i++) {
-            printf("Enter amount for %s: ", user_name(groups[gidx].member_ids[i]));
-            scanf("%lf", &share); getchar();
-            if(share < 0) {
-                printf("Amount must be non-negative.\n");
-                i--; continue;
+    }
+    fclose(ls.f);
+}
+
+void check_file(const char *path) {
+    char magic[4] = {0};
+    FILE *f = fopen(path, "rb");
+    if (f) {
+        if (fread(magic, 1, 4, f) != 4) magic[0] = 0;
+        fclose(f);
+    }
+    if (memcmp(magic, LEDGER_MAGIC, 4) == 0) check_binary_file(path);
+    else check_text_file(path);
+}
+
+int compare_check_rows(const void *a, const void *b) {
+    const CheckRow *x = a, *y = b;
+    if (x->id != y->id) return x->id < y->id ? -1 : 1;
+    if (x->user_id != y->user_id) return x->user_id < y->user_id ? -1 : 1;
+    if (x->file != y->file) return x->file - y->file;
+    return x->line < y->line ? -1 : x->line > y->line;
+}
+
+// First row with the given id in a table sorted by compare_check_rows, or NULL.
+const CheckRow *find_check_row(int kind, int id) {
+    const CheckTable *t = &check_tables[kind];
+    long lo = 0, hi = t->count;
+    while (lo < hi) {
+        long mid = (lo + hi) / 2;
+        if (t->rows[mid].id < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < t->count && t->rows[lo].id == id ? &t->rows[lo] : NULL;
+}
+
+int check_is_member(const CheckRow *group, int uid) {
+    Group g = {0};
+    g.member_ids = group->members;
+    g.member_count = group->member_count;
+    return group_has_member(&g, uid);
+}
+
+// Checks that uid is a known user and, if the group exists, one of its members.
+void check_member(ViolationList *v, const CheckRow *r, const CheckRow *group, int uid, const char *role) {
+    if (!find_check_row(CHECK_USER, uid)) add_violation(v, r, "%s %d is not a user", role, uid);
+    else if (group && !check_is_member(group, uid))
+        add_violation(v, r, "%s %d is not a member of group %d", role, uid, group->id);
+}
+
+typedef struct {
+    int index, count;
+    ViolationList out;
+} CheckWorker;
+
+// Checks this worker's slice of the expense, split and settlement tables against the sorted indexes.
+void *check_worker(void *arg) {
+    CheckWorker *w = arg;
+    ViolationList *v = &w->out;
+    const CheckTable *et = &check_tables[REC_EXPENSE], *sp = &check_tables[REC_SPLIT], *stt = &check_tables[REC_SETTLEMENT];
+
+    for (long i = et->count * w->index / w->count; i < et->count * (w->index + 1) / w->count; i++) {
+        const CheckRow *e = &et->rows[i], *g = find_check_row(CHECK_GROUP, e->group_id);
+        int duplicate = i > 0 && et->rows[i-1].id == e->id;
+        if (duplicate) add_violation(v, e, "duplicate expense id %d", e->id);
+        if (!g) add_violation(v, e, "expense %d belongs to missing group %d", e->id, e->group_id);
+        check_member(v, e, g, e->user_id, "payer");
+        if (e->cents <= 0) add_violation(v, e, "expense %d has a non-positive amount", e->id);
+        if (!e->date_ok) add_violation(v, e, "expense %d has an invalid date", e->id);
+        const CheckRow *first = find_check_row(REC_SPLIT, e->id);
+        long long sum = 0;
+        int count = 0;
+        for (const CheckRow *s = first; s && s < sp->rows + sp->count && s->id == e->id; s++, count++) sum += s->cents;
+        if (e->other_id) {
+            const CheckRow *r = find_check_row(CHECK_ROSTER, e->other_id);
+            if (!r) add_violation(v, e, "expense %d uses missing roster %d", e->id, e->other_id);
+            else if (r->group_id != e->group_id)
+                add_violation(v, e, "expense %d uses roster %d of group %d", e->id, e->other_id, r->group_id);
+            else if (!check_is_member(r, e->user_id))
+                add_violation(v, e, "payer %d is not on roster %d", e->user_id, e->other_id);
+            if (count) add_violation(v, e, "expense %d has both a roster and split rows", e->id);
+        } else if (duplicate) {
+            // the split rows can't be told apart between the copies, so their totals aren't checked
+        } else if (e->needs_splits && !count) add_violation(v, e, "expense %d has no splits", e->id);
+        // each share is rounded to the cent on its own, so allow half a cent per split
+        else if (count && 2 * (sum > e->cents ? sum - e->cents : e->cents - sum) > count)
+            add_violation(v, e, "splits of expense %d sum to %.2lf, not %.2lf", e->id, sum / 100.0, e->cents / 100.0);
+    }
+
+    for (long i = sp->count * w->index / w->count; i < sp->count * (w->index + 1) / w->count; i++) {
+        const CheckRow *s = &sp->rows[i], *e = find_check_row(REC_EXPENSE, s->id);
+        if (i > 0 && sp->rows[i-1].id == s->id && sp->rows[i-1].user_id == s->user_id)
+            add_violation(v, s, "duplicate split of expense %d for user %d", s->id, s->user_id);
+        if (!e) { add_violation(v, s, "split points at missing expense %d", s->id); continue; }
+        check_member(v, s, find_check_row(CHECK_GROUP, e->group_id), s->user_id, "split user");
+        if (s->cents < 0) add_violation(v, s, "split of expense %d is negative", s->id);
+    }
+
+    for (long i = stt->count * w->index / w->count; i < stt->count * (w->index + 1) / w->count; i++) {
+        const CheckRow *st = &stt->rows[i], *g = find_check_row(CHECK_GROUP, st->group_id);
+        if (i > 0 && stt->rows[i-1].id == st->id) add_violation(v, st, "duplicate settlement id %d", st->id);
+        if (!g) add_violation(v, st, "settlement %d belongs to missing group %d", st->id, st->group_id);
+        check_member(v, st, g, st->user_id, "payer");
+        check_member(v, st, g, st->other_id, "receiver");
+        if (st->cents <= 0) add_violation(v, st, "settlement %d has a non-positive amount", st->id);
+        if (!st->date_ok) add_violation(v, st, "settlement %d has an invalid date", st->id);
+    }
+    return NULL;
+}
+
+// Users, groups, recurring templates and id counters are few; checked on the calling thread.
+void check_small_tables(ViolationList *v) {
+    const CheckTable *ut = &check_tables[CHECK_USER], *gt = &check_tables[CHECK_GROUP], *rt = &check_tables[REC_RECURRING];
+    for (long i = 1; i < ut->count; i++)
+        if (ut->rows[i].id == ut->rows[i-1].id) add_violation(v, &ut->rows[i], "duplicate user id %d", ut->rows[i].id);
+    for (long i = 0; i < gt->count; i++) {
+        const CheckRow *g = &gt->rows[i];
+        if (i > 0 && gt->rows[i-1].id == g->id) add_violation(v, g, "duplicate group id %d", g->id);
+        for (int j = 0; j < g->member_count; j++)
+            if (!find_check_row(CHECK_USER, g->members[j])) add_violation(v, g, "member %d is not a user", g->members[j]);
+    }
+    for (long i = 0; i < rt->count; i++) {
+        const CheckRow *r = &rt->rows[i], *g = find_check_row(CHECK_GROUP, r->group_id);
+        if (i > 0 && rt->rows[i-1].id == r->id) add_violation(v, r, "duplicate recurring id %d", r->id);
+        if (!g) add_violation(v, r, "recurring %d belongs to missing group %d", r->id, r->group_id);
+        check_member(v, r, g, r->user_id, "payer");
+        for (int j = 0; j < r->member_count; j++) check_member(v, r, NULL, r->members[j], "member");
+        if (r->cents <= 0) add_violation(v, r, "recurring %d has a non-positive amount", r->id);
+        if (!r->date_ok) add_violation(v, r, "recurring %d has an invalid date or frequency", r->id);
+    }
+    const CheckTable *rst = &check_tables[CHECK_ROSTER];
+    for (long i = 0; i < rst->count; i++) {
+        const CheckRow *r = &rst->rows[i];
+        if (i > 0 && rst->rows[i-1].id == r->id) add_violation(v, r, "duplicate roster id %d", r->id);
+        if (!find_check_row(CHECK_GROUP, r->group_id)) add_violation(v, r, "roster %d belongs to missing group %d", r->id, r->group_id);
+        if (!r->member_count) add_violation(v, r, "roster %d has no members", r->id);
+        for (int j = 0; j < r->member_count; j++) check_member(v, r, NULL, r->members[j], "member");
+    }
+    const CheckTable *ot = &check_tables[REC_OPENING];
+    for (long i = 0; i < ot->count; i++) {
+        const CheckRow *o = &ot->rows[i], *g = find_check_row(CHECK_GROUP, o->group_id);
+        if (!g) add_violation(v, o, "opening balance belongs to missing group %d", o->group_id);
+        check_member(v, o, g, o->user_id, "creditor");
+        if (o->other_id) check_member(v, o, g, o->other_id, "debtor");
+        if (o->other_id && o->cents <= 0) add_violation(v, o, "opening balance has a non-positive amount");
+        if (!o->date_ok) add_violation(v, o, "opening balance has an invalid date");
+    }
+    const CheckTable *nt = &check_tables[CHECK_NEXT];
+    for (long i = 0; i < nt->count; i++) {
+        const CheckRow *n = &nt->rows[i];
+        const CheckTable *et = &check_tables[REC_EXPENSE], *stt = &check_tables[REC_SETTLEMENT];
+        if (et->count && n->id <= et->rows[et->count-1].id) add_violation(v, n, "next expense id %d is already used", n->id);
+        if (stt->count && n->group_id <= stt->rows[stt->count-1].id)
+            add_violation(v, n, "next settlement id %d is already used", n->group_id);
+        if (rt->count && n->user_id <= rt->rows[rt->count-1].id)
+            add_violation(v, n, "next recurring id %d is already used", n->user_id);
+    }
+}
+
+int compare_violations(const void *a, const void *b) {
+    const Violation *x = a, *y = b;
+    if (x->file != y->file) return x->file - y->file;
+    return x->line < y->line ? -1 : x->line > y->line;
+}
+
+// Checks the given files, or the whole store when none are given. Returns the number of violations.
+long run_check(char **paths, int count) {
+    if (count) {
+        for (int i = 0; i < count && num_check_files < MAX_GROUPS + 2; i++) check_file(paths[i]);
+    } else {
+        FILE *f = fopen(DIR_FILE, "r");
+        if (!f) check_file(DATA_FILE);
+        else {
+            check_file(DIR_FILE);
+            // The directory file's SHARD rows name each group's current shard file.
+            char line[MAX_LINE], *fld[8];
+            while (fgets(line, sizeof(line), f) && num_check_files < MAX_GROUPS + 2) {
+                if (strncmp(line, "SHARD|", 6) != 0) continue;
+                int n = split_fields(trim(line), fld, 8), gid = atoi(fld[1]), gen = n == 8 ? atoi(fld[7]) : 0;
+                char *path = malloc(64);
+                FILE *shard;
+                shard_file(path, 64, gid, gen);
+                if (!gen && !(shard = fopen(path, "rb"))) snprintf(path, 64, TEXT_SHARD_FILE_FMT, gid);
+                else if (!gen) fclose(shard);
+                if ((shard = fopen(path, "r"))) { fclose(shard); check_file(path); }
+                else free(path);
             }
-            splits[num_splits++] = (Split){eid, groups[gidx].member_ids[i], share};
-            total += share;
+            fclose(f);
         }
-        if (total != amt) {
-            printf("Error: Custom split does not sum to total amount! Expense not added.\n");
-            num_expenses--;
-            num_splits -= groups[gidx].member_count;
-            return;
+    }
+    long rows = 0;
+    for (int k = 0; k < CHECK_KINDS; k++) {
+        if (check_tables[k].count > 0)
+            qsort(check_tables[k].rows, check_tables[k].count, sizeof(CheckRow), compare_check_rows);
+        rows += check_tables[k].count;
+    }
+
+    int nworkers = 1;
+#ifndef _WIN32
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    nworkers = cpus < 1 ? 1 : cpus > 64 ? 64 : (int)cpus;
+    pthread_t threads[64];
+#endif
+    CheckWorker *workers = calloc(nworkers, sizeof(CheckWorker));
+    for (int i = 0; i < nworkers; i++) {
+        workers[i].index = i;
+        workers[i].count = nworkers;
+#ifndef _WIN32
+        pthread_create(&threads[i], NULL, check_worker, &workers[i]);
+#else
+        check_worker(&workers[i]);
+#endif
+    }
+    ViolationList all = check_parse_errors;
+    check_small_tables(&all);
+    for (int i = 0; i < nworkers; i++) {
+#ifndef _WIN32
+        pthread_join(threads[i], NULL);
+#endif
+        for (long j = 0; j < workers[i].out.count; j++) {
+            Violation *src = &workers[i].out.items[j];
+            CheckRow where = {src->file, src->line, 0, 0, 0, 0, 0, 0, 0, NULL, 0};
+            add_violation(&all, &where, "%s", src->text);
         }
+        free(workers[i].out.items);
     }
-    printf("Expense added!\n");
+    free(workers);
+    if (all.count > 0) qsort(all.items, all.count, sizeof(Violation), compare_violations);
+    for (long i = 0; i < all.count; i++)
+        printf("%s:%ld: %s\n", check_files[all.items[i].file], all.items[i].line, all.items[i].text);
+    printf("Checked %ld rows in %d file%s: %ld violation%s.\n", rows, num_check_files, num_check_files == 1 ? "" : "s",
+           all.count, all.count == 1 ? "" : "s");
+    return all.count;
 }
 
-void print_expenses() {
-    for (int i = 0; i < num_expenses; i++) {
-        printf("%d: Group: %s, Paid by: %s, Amount: %.2lf, Desc: %s, Date: %s, Cat: %s, Split: %s\n",
-            expenses[i].id, groups[find_group_index(expenses[i].group_id)].name, user_name(expenses[i].paid_by_user_id),
-            expenses[i].amount, expenses[i].description, expenses[i].date, expenses[i].category, expenses[i].split_type);
+// --merge: combines two ledgers, reading each once and writing the result as it goes. Users and
+// groups of the second ledger are matched to the first by name, its other ids are renumbered after the
+// first's, and its rows that repeat rows of the first are dropped. Both ledgers list users, groups and
+// rosters first (as save_data and save_store write them), so those are read from both before any other
+// row is written. A ledger is a text data file or a store: its directory file, whose SHARD rows name the
+// group shards read after it.
+enum { M_USER, M_GROUP, M_ROSTER, M_EXPENSE, M_SETTLEMENT, M_RECURRING, M_KINDS };
+
+// Open-addressing map from 64-bit keys (ids, or hashes of names and row contents) to non-zero ints.
+typedef struct {
+    unsigned long long *keys;
+    int *values; // 0 = empty slot
+    long count, size; // size is a power of two, at least 2 * count
+} MergeMap;
+
+MergeMap merge_ids[2][M_KINDS]; // per ledger: its ids -> merged ids, -1 for dropped rows
+MergeMap merge_names[M_KINDS]; // user and group names -> merged id + group index; roster contents -> merged id
+MergeMap merge_rows[2]; // row contents -> copies in the first / second ledger
+int merge_next[M_KINDS]; // highest merged id so far
+Group *merge_groups; int num_merge_groups = 0, merge_group_cap = 0;
+Roster *merge_rosters; int num_merge_rosters = 0, merge_roster_cap = 0;
+int merge_second = 0; // reading the second ledger
+int merge_groups_written = 0, merge_rosters_written = 0;
+FILE *merge_in[2];
+const char *merge_paths[2];
+char merge_bufs[2][MAX_LINE];
+long merge_linenos[2];
+int merge_pending[2]; // merge_bufs holds a row that has not been merged yet
+long merge_rows_read[2];
+char merge_dirs[2][512]; // directory a store's shard files are in
+ShardFile *merge_shards[2]; int num_merge_shards[2], merge_shard_caps[2], next_merge_shard[2]; // from SHARD rows
+char merge_shard_paths[2][600];
+long merge_matched = 0, merge_renumbered = 0, merge_duplicates = 0, merge_skipped = 0;
+
+unsigned long long hash_row(const char *s) {
+    unsigned long long h = 14695981039346656037ull;
+    while (*s) h = (h ^ (unsigned char)*s++) * 1099511628211ull;
+    return h;
+}
+
+int *merge_slot(MergeMap *m, unsigned long long key, int create) {
+    if (create && 2 * (m->count + 1) > m->size) {
+        MergeMap old = *m;
+        m->size = m->size ? m->size * 2 : 1024;
+        m->keys = calloc(m->size, sizeof(unsigned long long));
+        m->values = calloc(m->size, sizeof(int));
+        m->count = 0;
+        for (long i = 0; i < old.size; i++)
+            if (old.values[i]) *merge_slot(m, old.keys[i], 1) = old.values[i];
+        free(old.keys);
+        free(old.values);
     }
+    if (!m->size) return NULL;
+    unsigned long long h = key * 0x9E3779B97F4A7C15ull;
+    long slot = (long)((h ^ h >> 32) & (m->size - 1));
+    while (m->values[slot] && m->keys[slot] != key) slot = (slot + 1) & (m->size - 1);
+    if (!m->values[slot]) {
+        if (!create) return NULL;
+        m->keys[slot] = key;
+        m->count++;
+    }
+    return &m->values[slot];
 }
 
-void print_group_expenses(int group_id) {
-    for (int i = 0; i < num_expenses; i++) {
-        if (expenses[i].group_id == group_id) {
-            printf("%d: Paid by: %s, Amount: %.2lf, Desc: %s, Date: %s, Cat: %s, Split: %s\n",
-                expenses[i].id, user_name(expenses[i].paid_by_user_id), expenses[i].amount, expenses[i].description,
-                expenses[i].date, expenses[i].category, expenses[i].split_type);
-        }
+int merge_get(MergeMap *m, unsigned long long key) {
+    int *v = merge_slot(m, key, 0);
+    return v ? *v : 0;
+}
+
+// Merged id for an id the current ledger refers to. The first ledger keeps ids it never defined;
+// in the second they come back as 0.
+int merged_id(int kind, int id) {
+    int v = merge_get(&merge_ids[merge_second][kind], (unsigned)id);
+    return v ? v : merge_second ? 0 : id;
+}
+
+// Merged id for an id the current ledger defines: the first keeps its own, the second gets fresh ones.
+int define_id(int kind, int id) {
+    int out = id;
+    if (merge_second) out = ++merge_next[kind];
+    else if (id > merge_next[kind]) merge_next[kind] = id;
+    if (out != id) merge_renumbered++;
+    *merge_slot(&merge_ids[merge_second][kind], (unsigned)id, 1) = out;
+    return out;
+}
+
+// Whether a row of the second ledger repeats a row of the first that no earlier row of the second
+// matched, so identical rows already present in both copies appear once.
+int merge_duplicate(const char *content) {
+    unsigned long long key = hash_row(content);
+    int seen = ++*merge_slot(&merge_rows[merge_second], key, 1);
+    if (!merge_second || seen > merge_get(&merge_rows[0], key)) return 0;
+    merge_duplicates++;
+    return 1;
+}
+
+// Maps a comma-separated user id list into g's sorted members. Returns 0 if one is unknown.
+int merge_members(char *s, Group *g) {
+    Group raw = {0};
+    int ok = 1;
+    parse_member_ids(s, &raw);
+    for (int i = 0; i < raw.member_count; i++) {
+        int uid = merged_id(M_USER, raw.member_ids[i]);
+        if (uid) group_add_member(g, uid);
+        else ok = 0;
     }
+    free(raw.member_ids);
+    return ok;
 }
 
-void print_balances(int group_id) {
-    int gidx = find_group_index(group_id);
-    if (gidx == -1) { printf("Group not found.\n"); return; }
-    int mcount = groups[gidx].member_count;
-    double balance[MAX_USERS] = {0};
+// Appends "id,id,..." to a row's content key.
+int append_members(char *key, int len, int size, const int *ids, int count) {
+    for (int i = 0; i < count && len < size; i++) len += snprintf(key + len, size - len, "%d,", ids[i]);
+    return len;
+}
 
-    for (int i = 0; i < mcount; i++) {
-        int uid = groups[gidx].member_ids[i];
-        for (int j = 0; j < num_expenses; j++)
-            if (expenses[j].group_id == group_id && expenses[j].paid_by_user_id == uid)
-                balance[i] += expenses[j].amount;
-        for (int j = 0; j < num_splits; j++)
-            if (splits[j].user_id == uid) {
-                for (int k = 0; k < num_expenses; k++)
-                    if (splits[j].expense_id == expenses[k].id && expenses[k].group_id == group_id)
-                        balance[i] -= splits[j].amount;
+void merge_skip(const char *path, long lineno, const char *type) {
+    fprintf(stderr, "%s:%ld: %s row refers to an unknown id, skipped\n", path, lineno, type);
+    merge_skipped++;
+}
+
+void merge_line(FILE *out, char *line, const char *path, long lineno) {
+    static char key[MAX_LINE];
+    char *f[12];
+    int n = split_fields(line, f, 12);
+    if (strcmp(f[0], "USER") == 0 && n == 3) {
+        unsigned long long name = hash_row(f[2]);
+        int id = atoi(f[1]), match = merge_get(&merge_names[M_USER], name);
+        if (merge_second && match) {
+            *merge_slot(&merge_ids[merge_second][M_USER], (unsigned)id, 1) = match;
+            merge_matched++;
+            if (match != id) merge_renumbered++;
+            return;
+        }
+        id = define_id(M_USER, id);
+        if (!match) *merge_slot(&merge_names[M_USER], name, 1) = id;
+        fprintf(out, "USER|%d|%s\n", id, f[2]);
+    } else if (strcmp(f[0], "GROUP") == 0 && n == 4) {
+        unsigned long long name = hash_row(f[2]);
+        int id = atoi(f[1]), match = merge_get(&merge_names[M_GROUP], name);
+        Group g = {0};
+        if (!merge_members(f[3], &g)) merge_skip(path, lineno, "a member of the GROUP");
+        if (merge_second && match) {
+            Group *mg = &merge_groups[match - 1];
+            *merge_slot(&merge_ids[merge_second][M_GROUP], (unsigned)id, 1) = mg->id;
+            merge_matched++;
+            if (mg->id != id) merge_renumbered++;
+            for (int i = 0; i < g.member_count; i++) group_add_member(mg, g.member_ids[i]);
+            free(g.member_ids);
+            return;
+        }
+        if (num_merge_groups == merge_group_cap) {
+            merge_group_cap = merge_group_cap ? merge_group_cap * 2 : 16;
+            merge_groups = realloc(merge_groups, merge_group_cap * sizeof(Group));
+        }
+        g.id = define_id(M_GROUP, id);
+        snprintf(g.name, sizeof(g.name), "%s", f[2]);
+        merge_groups[num_merge_groups++] = g;
+        if (!match) *merge_slot(&merge_names[M_GROUP], name, 1) = num_merge_groups;
+    } else if (strcmp(f[0], "ROSTER") == 0 && n == 4) {
+        Group g = {0};
+        int id = atoi(f[1]), gid = merged_id(M_GROUP, atoi(f[2]));
+        if (!merge_members(f[3], &g) || !gid) {
+            free(g.member_ids);
+            merge_skip(path, lineno, f[0]);
+            return;
+        }
+        int len = snprintf(key, sizeof(key), "%d|", gid);
+        append_members(key, len, sizeof(key), g.member_ids, g.member_count);
+        // Equal rosters are shared, so expenses over the same members compare equal below.
+        unsigned long long content = hash_row(key);
+        int match = merge_get(&merge_names[M_ROSTER], content);
+        if (match) {
+            *merge_slot(&merge_ids[merge_second][M_ROSTER], (unsigned)id, 1) = match;
+            free(g.member_ids);
+            return;
+        }
+        if (num_merge_rosters == merge_roster_cap) {
+            merge_roster_cap = merge_roster_cap ? merge_roster_cap * 2 : 16;
+            merge_rosters = realloc(merge_rosters, merge_roster_cap * sizeof(Roster));
+        }
+        merge_rosters[num_merge_rosters++] = (Roster){define_id(M_ROSTER, id), gid, g.member_ids, g.member_count};
+        *merge_slot(&merge_names[M_ROSTER], content, 1) = merge_rosters[num_merge_rosters-1].id;
+    } else if (strcmp(f[0], "EXPENSE") == 0 && (n == 9 || n == 10)) {
+        Expense e = {0};
+        e.group_id = merged_id(M_GROUP, atoi(f[2]));
+        e.paid_by_user_id = merged_id(M_USER, atoi(f[3]));
+        e.amount = atof(f[4]);
+        snprintf(e.description, sizeof(e.description), "%s", f[5]);
+        snprintf(e.date, sizeof(e.date), "%s", f[6]);
+        snprintf(e.split_type, sizeof(e.split_type), "%s", f[7]);
+        snprintf(e.category, sizeof(e.category), "%s", f[8]);
+        e.roster_id = n == 10 ? merged_id(M_ROSTER, atoi(f[9])) : 0;
+        if (!e.group_id || !e.paid_by_user_id || (n == 10 && !e.roster_id)) {
+            *merge_slot(&merge_ids[merge_second][M_EXPENSE], (unsigned)atoi(f[1]), 1) = -1;
+            merge_skip(path, lineno, f[0]);
+            return;
+        }
+        snprintf(key, sizeof(key), "EXPENSE|%d|%d|%.2lf|%s|%s|%s|%s|%d", e.group_id, e.paid_by_user_id, e.amount,
+                 e.description, e.date, e.split_type, e.category, e.roster_id);
+        if (merge_duplicate(key)) {
+            *merge_slot(&merge_ids[merge_second][M_EXPENSE], (unsigned)atoi(f[1]), 1) = -1;
+            return;
+        }
+        e.id = define_id(M_EXPENSE, atoi(f[1]));
+        write_expense_row(out, &e);
+    } else if (strcmp(f[0], "SPLIT") == 0 && n == 4) {
+        Split sp = {merged_id(M_EXPENSE, atoi(f[1])), merged_id(M_USER, atoi(f[2])), atof(f[3])};
+        if (sp.expense_id < 0) return; // its expense was dropped
+        if (!sp.expense_id || !sp.user_id) { merge_skip(path, lineno, f[0]); return; }
+        write_split_row(out, &sp);
+    } else if (strcmp(f[0], "SETTLEMENT") == 0 && n == 7) {
+        Settlement st = {0};
+        st.payer_id = merged_id(M_USER, atoi(f[2]));
+        st.receiver_id = merged_id(M_USER, atoi(f[3]));
+        st.amount = atof(f[4]);
+        st.group_id = merged_id(M_GROUP, atoi(f[5]));
+        snprintf(st.date, sizeof(st.date), "%s", f[6]);
+        if (!st.payer_id || !st.receiver_id || !st.group_id) { merge_skip(path, lineno, f[0]); return; }
+        snprintf(key, sizeof(key), "SETTLEMENT|%d|%d|%.2lf|%d|%s", st.payer_id, st.receiver_id, st.amount,
+                 st.group_id, st.date);
+        if (merge_duplicate(key)) return;
+        st.id = define_id(M_SETTLEMENT, atoi(f[1]));
+        write_settlement_row(out, &st);
+    } else if (strcmp(f[0], "RECURRING") == 0 && n == 11) {
+        Recurring r = {0};
+        Group g = {0};
+        r.group_id = merged_id(M_GROUP, atoi(f[2]));
+        r.paid_by_user_id = merged_id(M_USER, atoi(f[3]));
+        r.amount = atof(f[4]);
+        snprintf(r.description, sizeof(r.description), "%s", f[5]);
+        snprintf(r.category, sizeof(r.category), "%s", f[6]);
+        snprintf(r.frequency, sizeof(r.frequency), "%s", f[7]);
+        snprintf(r.start_date, sizeof(r.start_date), "%s", f[8]);
+        snprintf(r.end_date, sizeof(r.end_date), "%s", strcmp(f[9], "-") == 0 ? "" : f[9]);
+        int ok = merge_members(f[10], &g);
+        r.member_ids = g.member_ids;
+        r.member_count = g.member_count;
+        if (!ok || !r.group_id || !r.paid_by_user_id) merge_skip(path, lineno, f[0]);
+        else {
+            int len = snprintf(key, sizeof(key), "RECURRING|%d|%d|%.2lf|%s|%s|%s|%s|%s|", r.group_id, r.paid_by_user_id,
+                               r.amount, r.description, r.category, r.frequency, r.start_date, r.end_date);
+            append_members(key, len, sizeof(key), r.member_ids, r.member_count);
+            if (!merge_duplicate(key)) {
+                r.id = define_id(M_RECURRING, atoi(f[1]));
+                write_recurring_row(out, &r);
             }
-        for (int j = 0; j < num_settlements; j++) {
-            if (settlements[j].group_id == group_id) {
-                if (settlements[j].payer_id == uid) balance[i] += settlements[j].amount;
-                if (settlements[j].receiver_id == uid) balance[i] -= settlements[j].amount;
+        }
+        free(g.member_ids);
+    } else if (strcmp(f[0], "OPENING") == 0 && n == 6) {
+        Opening o = {0};
+        o.group_id = merged_id(M_GROUP, atoi(f[1]));
+        o.debtor_id = atoi(f[2]) ? merged_id(M_USER, atoi(f[2])) : 0;
+        o.creditor_id = merged_id(M_USER, atoi(f[3]));
+        o.amount = atof(f[4]);
+        snprintf(o.date, sizeof(o.date), "%s", f[5]);
+        if (!o.group_id || (atoi(f[2]) && !o.debtor_id) || !o.creditor_id) { merge_skip(path, lineno, f[0]); return; }
+        snprintf(key, sizeof(key), "OPENING|%d|%d|%d|%.2lf|%s", o.group_id, o.debtor_id, o.creditor_id, o.amount, o.date);
+        if (!merge_duplicate(key)) write_opening_row(out, &o);
+    } else if (!(strcmp(f[0], "SHARD") == 0 || strcmp(f[0], "NEXT") == 0 || strcmp(f[0], "FEED") == 0)) {
+        fprintf(stderr, "%s:%ld: malformed %s row, skipped\n", path, lineno, f[0]);
+        merge_skipped++;
+    }
+}
+
+int is_header_row(const char *row) {
+    return strncmp(row, "USER|", 5) == 0 || strncmp(row, "GROUP|", 6) == 0 || strncmp(row, "ROSTER|", 7) == 0;
+}
+
+// Points ledger i at its next group shard, decoded to text rows; returns 0 when none are left.
+int merge_next_shard(int i) {
+    while (next_merge_shard[i] < num_merge_shards[i]) {
+        ShardFile sf = merge_shards[i][next_merge_shard[i]++];
+        char *path = merge_shard_paths[i];
+        int len = snprintf(path, sizeof(merge_shard_paths[i]), "%s/", merge_dirs[i]);
+        fclose(merge_in[i]);
+        merge_in[i] = NULL;
+        merge_paths[i] = path;
+        merge_linenos[i] = 0;
+        shard_file(path + len, sizeof(merge_shard_paths[i]) - len, sf.group_id, sf.gen);
+        if (load_ledger_bin(path)) {
+            // The binary rows go through the same text path as everything else.
+            if (!(merge_in[i] = tmpfile())) { perror("tmpfile"); exit(1); }
+            write_group_rows(merge_in[i], 0, 0, NULL);
+            rewind(merge_in[i]);
+            for (int r = 0; r < num_recurring; r++) free(recurring[r].member_ids);
+            num_expenses = num_splits = num_settlements = num_recurring = num_openings = 0;
+            return 1;
+        }
+        if (!sf.gen) {
+            snprintf(path + len, sizeof(merge_shard_paths[i]) - len, TEXT_SHARD_FILE_FMT, sf.group_id);
+            if ((merge_in[i] = fopen(path, "r"))) return 1;
+            shard_file(path + len, sizeof(merge_shard_paths[i]) - len, sf.group_id, sf.gen);
+        }
+        fprintf(stderr, "%s: missing, the rows of group %d were not merged\n", path, sf.group_id);
+        merge_skipped++;
+    }
+    return 0;
+}
+
+// Merges the rows of ledger i; with header_only set, stops before its first row that isn't a header row.
+void merge_input(FILE *out, int i, int header_only) {
+    merge_second = i;
+    for (;;) {
+        if (!merge_pending[i] && !(merge_in[i] && fgets(merge_bufs[i], MAX_LINE, merge_in[i]))) {
+            if (header_only || !merge_next_shard(i)) return;
+            continue;
+        }
+        if (!merge_pending[i]) merge_linenos[i]++;
+        merge_pending[i] = 0;
+        char *row = trim(merge_bufs[i]);
+        if (!*row) continue;
+        if (header_only && !is_header_row(row)) { merge_pending[i] = 1; return; }
+        if (strncmp(row, "SHARD|", 6) == 0) {
+            char *f[8];
+            int n = split_fields(row, f, 8);
+            // A shard with no rows may never have been written.
+            if (n >= 7 && atoi(f[2]) + atoi(f[3]) + atoi(f[4]) + atoi(f[5]) + atoi(f[6]) > 0) {
+                if (num_merge_shards[i] == merge_shard_caps[i]) {
+                    merge_shard_caps[i] = merge_shard_caps[i] ? merge_shard_caps[i] * 2 : 16;
+                    merge_shards[i] = realloc(merge_shards[i], merge_shard_caps[i] * sizeof(ShardFile));
+                }
+                merge_shards[i][num_merge_shards[i]++] = (ShardFile){atoi(f[1]), n == 8 ? atoi(f[7]) : 0};
             }
+            continue;
         }
+        merge_rows_read[i]++;
+        merge_line(out, row, merge_paths[i], merge_linenos[i]);
     }
-    printf("Balances for group '%s':\n", groups[gidx].name);
-    for (int i = 0; i < mcount; i++) {
-        int uid = groups[gidx].member_ids[i];
-        printf("  %s: %.2lf\n", user_name(uid), balance[i]);
+}
+
+// Opens ledger i: a store directory, a store's directory file or a text data file. Group shards are
+// rejected, since they can't be merged without the users and groups they refer to.
+int open_merge_input(int i, const char *path) {
+    char magic[4];
+    snprintf(merge_dirs[i], sizeof(merge_dirs[i]), "%s", path);
+    snprintf(merge_shard_paths[i], sizeof(merge_shard_paths[i]), "%s/" DIR_FILE, path);
+    if (!(merge_in[i] = fopen(merge_shard_paths[i], "r"))) {
+        snprintf(merge_shard_paths[i], sizeof(merge_shard_paths[i]), "%s/" DATA_FILE, path);
+        merge_in[i] = fopen(merge_shard_paths[i], "r");
     }
-    printf("Suggested settlements:\n");
-    double working[MAX_USERS];
-    memcpy(working, balance, sizeof(working));
-    for (int loop = 0; loop < mcount*2; loop++) {
-        int min_idx = -1, max_idx = -1;
-        for (int i = 0; i < mcount; i++) {
-            if (min_idx == -1 || working[i] < working[min_idx])
-                if (working[i] < 0) min_idx = i;
-            if (max_idx == -1 || working[i] > working[max_idx])
-                if (working[i] > 0) max_idx = i;
+    if (merge_in[i]) {
+        merge_paths[i] = strdup(merge_shard_paths[i]);
+        return 1;
+    }
+    char *slash = strrchr(merge_dirs[i], '/');
+    if (slash) *slash = 0;
+    else strcpy(merge_dirs[i], ".");
+    merge_paths[i] = path;
+    if (!(merge_in[i] = fopen(path, "r"))) { perror(path); return 0; }
+    if (fread(magic, 1, 4, merge_in[i]) == 4 && memcmp(magic, LEDGER_MAGIC, 4) == 0) {
+        printf("%s is a group shard; pass its store directory or %s instead.\n", path, DIR_FILE);
+        return 0;
+    }
+    rewind(merge_in[i]);
+    return 1;
+}
+
+// Writes the groups and rosters not written yet. One that turns up after other rows is written late, and
+// members a later match adds to it are lost.
+void merge_flush_groups(FILE *out) {
+    for (; merge_groups_written < num_merge_groups; merge_groups_written++)
+        write_group_row(out, &merge_groups[merge_groups_written]);
+    for (; merge_rosters_written < num_merge_rosters; merge_rosters_written++)
+        write_roster_row(out, &merge_rosters[merge_rosters_written]);
+}
+
+// Writes the merge of two ledgers to path as a text data file. Returns non-zero on failure or if rows
+// were skipped.
+int run_merge(const char *first, const char *second, const char *path) {
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if (!open_merge_input(0, first) || !open_merge_input(1, second)) return 1;
+    FILE *out = fopen(tmp, "w");
+    if (!out) { perror(tmp); return 1; }
+    merge_input(out, 0, 1);
+    merge_input(out, 1, 1);
+    merge_flush_groups(out);
+    merge_input(out, 0, 0);
+    merge_input(out, 1, 0);
+    merge_flush_groups(out);
+    for (int i = 0; i < 2; i++) {
+        if (merge_in[i]) fclose(merge_in[i]);
+        if (!merge_rows_read[i]) {
+            printf("%s has no ledger rows; nothing was merged.\n", i ? second : first);
+            fclose(out);
+            remove(tmp);
+            return 1;
         }
-        if (min_idx == -1 || max_idx == -1) break;
-        double amt = -working[min_idx] < working[max_idx] ? -working[min_idx] : working[max_idx];
-        if (amt < 0.01) break;
-        printf("  %s pays %s: %.2lf\n", user_name(groups[gidx].member_ids[min_idx]),
-                                         user_name(groups[gidx].member_ids[max_idx]), amt);
-        working[min_idx] += amt;
-        working[max_idx] -= amt;
     }
+    if (!close_durably(out) || !replace_file(tmp, path)) {
+        printf("Could not write %s\n", path);
+        return 1;
+    }
+    printf("Merged %s and %s into %s: %ld users and groups matched by name, %ld ids renumbered, "
+           "%ld duplicate rows dropped, %ld rows skipped.\n", first, second, path, merge_matched, merge_renumbered,
+           merge_duplicates, merge_skipped);
+    return merge_skipped ? 1 : 0;
 }
 
-void balances_menu() {
-    print_groups();
-    printf("Enter group ID: ");
-    int gid;
-    scanf("%d", &gid); getchar();
-    print_balances(gid);
+#ifndef _WIN32
+// --load: replays a trace of batch commands against the engine from several client threads and reports
+// throughput and latency percentiles per command. The engine itself runs one command at a time, so a
+// command's latency includes the time it waited for the others.
+typedef struct {
+    char *line;
+    double due; // seconds after the start, or -1 to run as soon as a client is free
+} TraceOp;
+
+typedef struct {
+    char name[16];
+    double *latencies; // seconds, of the commands that succeeded
+    long count, cap, failed;
+} OpStats;
+
+TraceOp *trace_ops; long num_trace_ops = 0, next_trace_op = 0;
+OpStats op_stats[MAX_OP_TYPES]; int num_op_types = 0;
+int load_save_every = 0;
+long load_mutations = 0;
+struct timespec load_start;
+pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t engine_lock = PTHREAD_MUTEX_INITIALIZER;
+
+double load_clock() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - load_start.tv_sec) + (now.tv_nsec - load_start.tv_nsec) / 1e9;
 }
 
-void group_expenses_menu() {
-    print_groups();
-    printf("Enter group ID: ");
-    int gid;
-    scanf("%d", &gid); getchar();
-    print_group_expenses(gid);
+void record_latency(const char *name, double seconds, int ok) {
+    int t = 0;
+    while (t < num_op_types && strcmp(op_stats[t].name, name) != 0) t++;
+    if (t == num_op_types) {
+        if (num_op_types == MAX_OP_TYPES) return;
+        snprintf(op_stats[num_op_types++].name, sizeof(op_stats[t].name), "%s", name);
+    }
+    OpStats *st = &op_stats[t];
+    // A failed command usually returns early, so its latency would flatter the percentiles.
+    if (!ok) { st->failed++; return; }
+    if (st->count == st->cap) {
+        st->cap = st->cap ? st->cap * 2 : 256;
+        st->latencies = realloc(st->latencies, st->cap * sizeof(double));
+    }
+    st->latencies[st->count++] = seconds;
 }
 
-void settlements_menu() {
-    if (num_settlements >= MAX_SETTLEMENTS) {
-        printf("Settlement limit reached!\n");
-        return;
+void *load_client(void *arg) {
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&trace_lock);
+        long i = next_trace_op < num_trace_ops ? next_trace_op++ : -1;
+        pthread_mutex_unlock(&trace_lock);
+        if (i < 0) return NULL;
+        TraceOp *op = &trace_ops[i];
+        double start = op->due, wait = op->due - load_clock();
+        if (op->due < 0) start = load_clock();
+        else if (wait > 0) {
+            struct timespec ts = {(time_t)wait, (long)((wait - (time_t)wait) * 1e9)};
+            nanosleep(&ts, NULL);
+        }
+        // Paced commands are timed from when they were due, so a stall also counts against the ones queued behind it.
+        pthread_mutex_lock(&engine_lock);
+        int ok = run_batch_line(op->line); // leaves just the command name in op->line
+        if (ok && load_save_every && strcmp(op->line, "balances") != 0 && strcmp(op->line, "list") != 0 &&
+            ++load_mutations % load_save_every == 0) {
+            double t = load_clock();
+            save_store();
+            record_latency("(save)", load_clock() - t, 1);
+        }
+        record_latency(op->line, load_clock() - start, ok);
+        pthread_mutex_unlock(&engine_lock);
     }
-    print_groups();
-    printf("Enter group ID: ");
-    int gid;
-    scanf("%d", &gid); getchar();
-    int gidx = find_group_index(gid);
-    if(gidx<0) { printf("Group not found.\n"); return; }
-    print_balances(gid);
-    printf("Enter payer user ID: ");
-    int payer; scanf("%d", &payer); getchar();
-    printf("Enter receiver user ID: ");
-    int receiver; scanf("%d", &receiver); getchar();
-    printf("Enter amount: ");
-    double amt; scanf("%lf", &amt); getchar();
-    if (amt <= 0) {
-        printf("Settlement amount must be positive.\n");
-        return;
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+double percentile(const OpStats *st, double p) {
+    long i = (long)(p * st->count + 0.999999) - 1; // nearest rank
+    return st->latencies[i < 0 ? 0 : i];
+}
+
+// Reads the trace ("@SECONDS command" keeps recorded timing) and replays it. A positive rate paces
+// every command at that many per second instead. Returns the number of failed commands.
+int run_load(const char *path, int clients, double rate) {
+    FILE *in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!in) { perror(path); return 1; }
+    char line[MAX_LINE];
+    long cap = 0;
+    while (fgets(line, sizeof(line), in)) {
+        char *cmd = trim(line);
+        double due = -1;
+        if (*cmd == '@') {
+            due = strtod(cmd + 1, &cmd);
+            cmd = trim(cmd);
+        }
+        if (!*cmd || *cmd == '#') continue;
+        if (num_trace_ops == cap) {
+            cap = cap ? cap * 2 : 1024;
+            trace_ops = realloc(trace_ops, cap * sizeof(TraceOp));
+        }
+        trace_ops[num_trace_ops] = (TraceOp){strdup(cmd), rate > 0 ? num_trace_ops / rate : due};
+        num_trace_ops++;
     }
-    printf("Enter date (DD-MM-YYYY): ");
-    char date[16]; fgets(date, sizeof(date), stdin); strcpy(date, trim(date));
-    if (!is_valid_date(date)) {
-        printf("Invalid date format. Use DD-MM-YYYY.\n");
-        return;
+    if (in != stdin) fclose(in);
+
+    // Commands print as they would in batch mode; keep that off the report.
+    fflush(stdout);
+    int saved_stdout = dup(1), null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, 1);
+    pthread_t *threads = malloc(clients * sizeof(pthread_t));
+    clock_gettime(CLOCK_MONOTONIC, &load_start);
+    for (int i = 0; i < clients; i++) pthread_create(&threads[i], NULL, load_client, NULL);
+    for (int i = 0; i < clients; i++) pthread_join(threads[i], NULL);
+    double elapsed = load_clock();
+    fflush(stdout);
+    dup2(saved_stdout, 1);
+    close(null_fd);
+    close(saved_stdout);
+    free(threads);
+
+    long failed = 0;
+    printf("%ld commands from %d client%s in %.3lf s: %.0lf/s\n", num_trace_ops, clients, clients == 1 ? "" : "s",
+           elapsed, elapsed > 0 ? num_trace_ops / elapsed : 0);
+    printf("%-12s %8s %7s %10s %10s %10s %10s\n", "command", "ok", "failed", "ok/s", "p50 ms", "p99 ms", "p999 ms");
+    for (int t = 0; t < num_op_types; t++) {
+        OpStats *st = &op_stats[t];
+        qsort(st->latencies, st->count, sizeof(double), compare_doubles);
+        printf("%-12s %8ld %7ld %10.0lf", st->name, st->count, st->failed, elapsed > 0 ? st->count / elapsed : 0);
+        if (st->count)
+            printf(" %10.3lf %10.3lf %10.3lf\n", percentile(st, 0.50) * 1e3, percentile(st, 0.99) * 1e3,
+                   percentile(st, 0.999) * 1e3);
+        else printf(" %10s %10s %10s\n", "-", "-", "-");
+        failed += st->failed;
     }
-    int sid = num_settlements ? settlements[num_settlements-1].id+1 : 1;
-    settlements[num_settlements++] = (Settlement){sid, payer, receiver, amt, gid, ""};
-    strncpy(settlements[num_settlements-1].date, date, 15);
-    printf("Settlement recorded!\n");
+    if (failed) printf("%ld commands failed and are left out of the latencies.\n", failed);
+    return failed;
 }
 
-void settlements_history_menu() {
-    print_groups();
-    printf("Enter group ID: ");
-    int gid;
-    scanf("%d", &gid); getchar();
-    printf("Settlements for this group:\n");
-    for(int i=0; i<num_settlements; ++i) {
-        if(settlements[i].group_id == gid) {
-            printf("%d: %s paid %s %.2lf on %s\n", settlements[i].id, user_name(settlements[i].payer_id),
-                   user_name(settlements[i].receiver_id), settlements[i].amount, settlements[i].date);
+// Replays the trace on a scratch copy of the ledger: everything is loaded first, then the working
+// directory moves to a temporary one, so saves and the feed log land there and are deleted afterwards.
+int run_load_scratch(const char *path, int clients, double rate) {
+    char scratch[] = "/tmp/splitwise-load-XXXXXX", cwd[4096], trace[4200];
+    if (!open_all_groups()) printf("Not every group fits in memory; the trace runs without the rest.\n");
+    if (!getcwd(cwd, sizeof(cwd)) || !mkdtemp(scratch) || chdir(scratch) != 0) { perror(scratch); return 1; }
+    if (*path == '/' || strcmp(path, "-") == 0) snprintf(trace, sizeof(trace), "%s", path);
+    else snprintf(trace, sizeof(trace), "%s/%s", cwd, path);
+    int failed = run_load(trace, clients, rate);
+    if (feed_fd >= 0) { close(feed_fd); feed_fd = -1; }
+    if (feed_log) { fclose(feed_log); feed_log = NULL; }
+    DIR *d = opendir(".");
+    struct dirent *de;
+    while (d && (de = readdir(d)))
+        if (strcmp(de->d_name, ".") != 0 && strcmp(de->d_name, "..") != 0) remove(de->d_name);
+    if (d) closedir(d);
+    if (chdir(cwd) != 0 || rmdir(scratch) != 0) perror(scratch);
+    return failed;
+}
+
+// Writes a synthetic trace for --load: users and groups first, then bursts that alternate between a
+// trip weekend (one group adding expenses fast) and month-end (settling and checking balances everywhere).
+// Users and groups are named rather than numbered so the trace works on top of an existing ledger, and
+// once an empty ledger's expense or settlement table would be full, those commands turn into balance checks.
+void make_trace(long count, unsigned seed) {
+    int nusers = 40, ngroups = 20, members[20][8], nmembers[20], nexpenses = 0, nsettlements = 0;
+    double t = 0;
+    srand(seed);
+    for (int u = 1; u <= nusers; u++) printf("@0 add-user trace-user-%d\n", u);
+    for (int g = 0; g < ngroups; g++) {
+        nmembers[g] = 3 + rand() % 6;
+        int first = 1 + rand() % (nusers - nmembers[g] + 1);
+        printf("@0 add-group trace-group-%d|", g + 1);
+        for (int j = 0; j < nmembers[g]; j++) {
+            members[g][j] = first + j;
+            printf("trace-user-%d%s", members[g][j], j + 1 < nmembers[g] ? "," : "\n");
+        }
+    }
+    for (long n = 0, day = 0; n < count; day++) {
+        int trip = day % 4 != 3, g = rand() % ngroups, burst = 50 + rand() % 150;
+        char date[16];
+        days_to_date(date_to_days("01-01-2025") + day, date);
+        for (int b = 0; b < burst && n < count; b++, n++) {
+            int roll = rand() % 100, gg = trip ? g : rand() % ngroups;
+            int ai = rand() % nmembers[gg], a = members[gg][ai];
+            int c = members[gg][(ai + 1 + rand() % (nmembers[gg] - 1)) % nmembers[gg]];
+            t += trip ? 0.0005 : 0.001;
+            if ((trip ? roll < 85 : roll < 20) && nexpenses < MAX_EXPENSES) {
+                printf("@%.4lf add-expense trace-group-%d|trace-user-%d|%d.%02d|Item %ld|Food|%s|equal\n", t, gg + 1, a,
+                       5 + rand() % 200, rand() % 100, n, date);
+                nexpenses++;
+            } else if ((trip ? roll >= 85 && roll < 90 : roll >= 20 && roll < 60) && nsettlements < MAX_SETTLEMENTS) {
+                printf("@%.4lf settle trace-group-%d|trace-user-%d|trace-user-%d|%d.00|%s\n", t, gg + 1, a, c,
+                       1 + rand() % 50, date);
+                nsettlements++;
+            } else printf("@%.4lf balances trace-group-%d\n", t, gg + 1);
         }
+        t += 0.2; // quiet period between bursts
     }
 }
+#endif
 
 // Shreyas
-int main() {
-    load_data(DATA_FILE); // Shreyas
+int main(int argc, char **argv) {
+    if (argc >= 2 && (strcmp(argv[1], "--feed") == 0 || strcmp(argv[1], "--follow") == 0))
+        return run_feed(argc >= 3 ? atol(argv[2]) : 0, strcmp(argv[1], "--follow") == 0);
+    if (argc >= 2 && strcmp(argv[1], "--check") == 0)
+        return run_check(argv + 2, argc - 2) ? 1 : 0;
+    if (argc >= 5 && strcmp(argv[1], "--merge") == 0)
+        return run_merge(argv[2], argv[3], argv[4]);
+#ifndef _WIN32
+    if (argc >= 3 && strcmp(argv[1], "--make-trace") == 0) {
+        make_trace(atol(argv[2]), argc >= 4 ? (unsigned)atol(argv[3]) : 1);
+        return 0;
+    }
+#endif
+#ifndef _WIN32
+    signal(SIGPIPE, SIG_IGN); // a feed consumer going away must not kill the tool
+#endif
+    load_store(); // Shreyas
+    if (argc >= 2 && strcmp(argv[1], "--batch") == 0) {
+        FILE *in = stdin;
+        int every = 0;
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "--every") == 0 && i + 1 < argc) every = atoi(argv[++i]);
+            else if (!(in = fopen(argv[i], "r"))) { perror(argv[i]); return 1; }
+        }
+        return run_batch(in, every) ? 1 : 0;
+    }
+#ifndef _WIN32
+    if (argc >= 2 && strcmp(argv[1], "--ingest") == 0) {
+        char **sources = malloc(argc * sizeof(char *));
+        int count = 0;
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "--batch-size") == 0 && i + 1 < argc) ingest_batch_size = atoi(argv[++i]);
+            else if (strcmp(argv[i], "--max-latency") == 0 && i + 1 < argc) ingest_latency_ms = atoi(argv[++i]);
+            else sources[count++] = argv[i];
+        }
+        if (ingest_batch_size < 1) ingest_batch_size = 1;
+        if (ingest_latency_ms < 0) ingest_latency_ms = 0;
+        if (!count) sources[count++] = "-";
+        int failed = run_ingest(sources, count);
+        free(sources);
+        return failed ? 1 : 0;
+    }
+    if (argc >= 3 && strcmp(argv[1], "--load") == 0) {
+        int clients = 1;
+        double rate = 0;
+        for (int i = 3; i + 1 < argc; i += 2) {
+            if (strcmp(argv[i], "--concurrency") == 0) clients = atoi(argv[i + 1]);
+            else if (strcmp(argv[i], "--rate") == 0) rate = atof(argv[i + 1]);
+            else if (strcmp(argv[i], "--save-every") == 0) load_save_every = atoi(argv[i + 1]);
+        }
+        if (clients < 1) clients = 1;
+        return run_load_scratch(argv[2], clients, rate) ? 1 : 0;
+    }
+#endif
     int choice;
     while (1) {
         printf("\nSplitwise CLI Menu\n"
@@ -557,6 +4458,16 @@ int main() {
                "8. Show Balances for Group\n"
                "9. Mark Settlement\n"
                "10. Show Settlement History\n"
+               "11. Show Who Owes Whom\n"
+               "12. Show Balances as of Date\n"
+               "13. Search Expenses\n"
+               "14. Show Top Expenses\n"
+               "15. Show Top Spenders\n"
+               "16. Add Recurring Expense\n"
+               "17. Show My Shares\n"
+               "18. Archive Old History\n"
+               "19. List Expenses (sorted)\n"
+               "20. Settle Up All Balances\n"
                "0. Exit\n"
                "Choice: ");
         scanf("%d", &choice); getchar();
@@ -571,9 +4482,19 @@ int main() {
             case 8: balances_menu(); break; // Siddhant
             case 9: settlements_menu(); break; // Skanda
             case 10: settlements_history_menu(); break; // Skanda
-            case 0: save_data(DATA_FILE); printf("Bye!\n"); return 0;
+            case 11: pair_debts_menu(); break;
+            case 12: balances_as_of_menu(); break;
+            case 13: search_menu(); break;
+            case 14: top_expenses_menu(); break;
+            case 15: top_spenders_menu(); break;
+            case 16: add_recurring_interactive(); break;
+            case 17: shares_menu(); break;
+            case 18: archive_menu(); break;
+            case 19: list_menu(); break;
+            case 20: settle_all_menu(); break;
+            case 0: save_store(); printf("Bye!\n"); return 0;
             default: printf("Invalid choice\n");
         }
-        save_data(DATA_FILE); // Shreyas
+        save_store(); // Shreyas
     }
 }
\ No newline at end of file